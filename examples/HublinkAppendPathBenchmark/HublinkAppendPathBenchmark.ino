@@ -0,0 +1,110 @@
+// Benchmarks append_path resolution: the compiled HublinkPathResolver against
+// the String-based split/lookup/sanitize approach it replaced.
+// No SD card or BLE is needed; results print to Serial.
+#include <Hublink.h>
+
+const int ITERATIONS = 2000;
+const int DEPTH = HublinkPathResolver::MAX_TOKENS; // deepest supported append_path
+
+DynamicJsonDocument doc(4096);
+String appendPath;
+
+// Reference: String-based resolution as done before HublinkPathResolver
+String legacyResolve(const JsonDocument &d, const String &basePath, const String &path)
+{
+  String finalPath = basePath;
+  int startPos = 0;
+  int slashPos;
+  while ((slashPos = path.indexOf('/', startPos)) != -1 || startPos < (int)path.length())
+  {
+    String pair = slashPos == -1 ? path.substring(startPos) : path.substring(startPos, slashPos);
+    startPos = slashPos == -1 ? path.length() : slashPos + 1;
+
+    int colonPos = pair.indexOf(':');
+    if (colonPos == -1)
+      continue;
+    String parent = pair.substring(0, colonPos);
+    String child = pair.substring(colonPos + 1);
+    if (!d.containsKey(parent) || !d[parent].containsKey(child))
+      continue;
+    String value = d[parent][child].as<String>();
+    value.trim();
+    if (value.length() > 0)
+    {
+      if (!finalPath.endsWith("/"))
+        finalPath += "/";
+      finalPath += value;
+    }
+  }
+
+  String sanitized = "";
+  for (char c : finalPath)
+  {
+    if (isalnum(c) || c == '-' || c == '_' || c == '+' || c == '.' || c == '/')
+      sanitized += c;
+  }
+  while (sanitized.indexOf("//") != -1)
+    sanitized.replace("//", "/");
+  while (sanitized.endsWith("/"))
+    sanitized = sanitized.substring(0, sanitized.length() - 1);
+  return sanitized;
+}
+
+void printHeap(const char *label)
+{
+  Serial.printf("[%s] Free: %lu, MaxBlock: %lu\n", label, ESP.getFreeHeap(), ESP.getMaxAllocHeap());
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  // Build a meta.json-like document with DEPTH parents
+  for (int i = 0; i < DEPTH; i++)
+  {
+    String parent = "level" + String(i);
+    doc[parent]["id"] = " value_" + String(i) + " ";
+    if (i > 0)
+      appendPath += "/";
+    appendPath += parent + ":id";
+  }
+  Serial.printf("append_path (%d segments): %s\n", DEPTH, appendPath.c_str());
+
+  printHeap("START");
+
+  // Legacy String path
+  uint32_t start = micros();
+  String legacy;
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    legacy = legacyResolve(doc, "/FED//data/", appendPath);
+  }
+  uint32_t legacyUs = micros() - start;
+  printHeap("LEGACY");
+
+  // Compiled resolver (compile is done once, as Hublink does on meta.json change)
+  HublinkPathResolver resolver;
+  char resolved[256];
+  start = micros();
+  resolver.compile(appendPath.c_str());
+  uint32_t compileUs = micros() - start;
+
+  start = micros();
+  for (int i = 0; i < ITERATIONS; i++)
+  {
+    resolver.resolve(doc, "/FED//data/", resolved, sizeof(resolved));
+  }
+  uint32_t resolveUs = micros() - start;
+  printHeap("RESOLVER");
+
+  Serial.printf("Legacy:   %s\n", legacy.c_str());
+  Serial.printf("Resolver: %s\n", resolved);
+  Serial.printf("Match: %s\n", legacy == resolved ? "yes" : "NO");
+  Serial.printf("Legacy:   %.2f us/resolve\n", (float)legacyUs / ITERATIONS);
+  Serial.printf("Resolver: %.2f us/resolve (compile once: %lu us)\n", (float)resolveUs / ITERATIONS, compileUs);
+}
+
+void loop()
+{
+}
@@ -0,0 +1,61 @@
+#include <Hublink.h>
+
+const int cs = A0;
+Hublink hublink(cs); // Use default Hublink instance
+
+const unsigned long SAMPLE_EVERY_MS = 100;
+unsigned long lastSample = 0;
+unsigned long maxGap = 0; // longest time between samples, should stay near SAMPLE_EVERY_MS
+
+void onSyncComplete(bool success)
+{
+  // Runs on the sync task, not in loop()
+  Serial.printf("Sync %s, max sample gap: %lu ms\n", success ? "succeeded" : "ended without transfer", maxGap);
+}
+
+void setup()
+{
+  Serial.begin(9600);
+  delay(1000);
+
+  // initialize SPI for SD card
+  // SPI.begin(SCK, MISO, MOSI, cs); // if not using default SCK, MISO, MOSI
+  if (hublink.begin())
+  {
+    Serial.println("✓ Hublink.");
+  }
+  else
+  {
+    Serial.println("✗ Failed.");
+    while (1)
+    {
+    }
+  }
+}
+
+void loop()
+{
+  unsigned long now = millis();
+  if (now - lastSample >= SAMPLE_EVERY_MS)
+  {
+    if (lastSample > 0)
+    {
+      maxGap = max(maxGap, now - lastSample);
+    }
+    lastSample = now;
+
+    File data = SD.open("/samples.csv", FILE_APPEND);
+    if (data)
+    {
+      data.printf("%lu,%d\n", now, analogRead(A1));
+      data.close();
+    }
+  }
+
+  // Start a background sync when one is due; loop() keeps sampling while it runs
+  if (!hublink.isSyncing() && hublink.getMsUntilNextSync() == 0)
+  {
+    hublink.syncAsync(0, onSyncComplete);
+  }
+  delay(1);
+}
@@ -2,6 +2,7 @@
 
 const int cs = A0;
 Hublink hublink(cs); // Use default Hublink instance
+const uint64_t MIN_SLEEP_MS = 1000; // a sync due right away (e.g. a retry) still gets a short sleep
 
 void printMemory(const char *label)
 {
@@ -41,11 +42,14 @@ void setup()
 
 void loop()
 {
-  hublink.sync(10); // only blocks when ready
+  hublink.sync(); // scheduler state survives deep sleep, so this only advertises when due
   printMemory("SYNC");
-  delay(500);
 
   // hublink.sleep(1000); // optional light sleep
-  esp_sleep_enable_timer_wakeup(2 * 1000000); // 2 seconds in microseconds
+  // Sleep straight through to the next advertise or retry window
+  uint64_t sleepMs = std::max(hublink.getMsUntilNextSync(), MIN_SLEEP_MS);
+  Serial.printf("Deep sleeping for %llu ms\n", sleepMs);
+  Serial.flush();
+  esp_sleep_enable_timer_wakeup(sleepMs * 1000ULL); // microseconds
   esp_deep_sleep_start();
-}
\ No newline at end of file
+}
@@ -0,0 +1,66 @@
+#include <Hublink.h>
+#include <HublinkLogger.h>
+
+const int cs = A0;
+Hublink hublink(cs); // Use default Hublink instance
+HublinkLogger logger(hublink);
+
+// One fixed-size record per sample; formatted to CSV on the writer task
+struct Sample
+{
+  uint32_t ms;
+  int16_t value;
+};
+
+size_t formatSample(const void *record, char *out, size_t outSize)
+{
+  const Sample *s = (const Sample *)record;
+  return snprintf(out, outSize, "%lu,%d\n", (unsigned long)s->ms, s->value);
+}
+
+const unsigned long SAMPLE_EVERY_US = 1000; // 1 kHz
+unsigned long lastSample = 0;
+
+void setup()
+{
+  Serial.begin(9600);
+  delay(1000);
+
+  // initialize SPI for SD card
+  // SPI.begin(SCK, MISO, MOSI, cs); // if not using default SCK, MISO, MOSI
+  if (!hublink.begin())
+  {
+    Serial.println("✗ Failed.");
+    while (1)
+    {
+    }
+  }
+  Serial.println("✓ Hublink.");
+
+  // Seal a file every 1 MB or hour; only sealed files are offered to the gateway
+  logger.setRotation(1024 * 1024, 3600);
+
+  // 1024 records covers about a second of SD or BLE stalls at 1 kHz
+  if (!logger.begin("samples.csv", sizeof(Sample), 1024, formatSample))
+  {
+    Serial.println("✗ Logger failed.");
+  }
+}
+
+void loop()
+{
+  unsigned long now = micros();
+  if (now - lastSample >= SAMPLE_EVERY_US)
+  {
+    lastSample = now;
+    Sample s = {millis(), (int16_t)analogRead(A1)};
+    logger.push(&s); // never blocks; counts a drop if the ring is full
+  }
+
+  // Transfers run on the sync task and share the card with the logger
+  if (!hublink.isSyncing() && hublink.getMsUntilNextSync() == 0)
+  {
+    Serial.printf("Logged %lu, dropped %lu\n", logger.getWrittenCount(), logger.getDroppedCount());
+    hublink.syncAsync();
+  }
+}
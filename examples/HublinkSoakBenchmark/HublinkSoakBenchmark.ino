@@ -0,0 +1,124 @@
+// Soak test for heap fragmentation on the sync path.
+// Runs thousands of simulated syncs without a gateway: stage the file listing,
+// resolve and read every listed file, and parse a gateway command, the way
+// doBLE() does, through the storage backend and the same String-free path
+// helpers the transfer loop uses. Free heap, the largest free block
+// and fragmentation are printed at intervals; on a healthy build the largest
+// block stays flat after the first sync.
+// Needs the storage medium (SD card by default); a few test files are created
+// in its root directory.
+#include <Hublink.h>
+
+const int cs = A0;
+const int SYNCS = 5000;
+const int REPORT_EVERY = 250;
+const int TEST_FILES = 24;
+
+// Subclass only to reach the sync internals without BLE
+class SoakHublink : public Hublink
+{
+public:
+  using Hublink::Hublink;
+
+  size_t simulateSync()
+  {
+    invalidateListing();
+    if (!stageListing(0))
+    {
+      return 0;
+    }
+    prefetchFirstFile();
+
+    // "Transfer" every listed file: resolve, open, read the first sector
+    size_t opened = 0;
+    uint8_t sector[512];
+    for (const char *entry = stagedListing.c_str(); *entry != '\0';)
+    {
+      const char *bar = strchr(entry, '|');
+      const char *next = strchr(entry, ';');
+      if (!bar)
+      {
+        break;
+      }
+      char name[64];
+      snprintf(name, sizeof(name), "%.*s", (int)(bar - entry), entry);
+      char path[MAX_FILE_PATH];
+      File file = files().open(resolveFilePath(name, path, sizeof(path)), FILE_READ);
+      if (file)
+      {
+        file.read(sector, sizeof(sector));
+        file.close();
+        opened++;
+      }
+      entry = next ? next + 1 : bar + strlen(bar);
+    }
+
+    static const char command[] = "{\"timestamp\":1700000000,\"watchdogTimeoutMs\":10000}";
+    handleGatewayCommand(sessions[0], command, sizeof(command) - 1); // no gateway: replies are skipped
+    return opened;
+  }
+};
+
+SoakHublink hublink(cs);
+
+void printHeap(int sync)
+{
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxBlock = ESP.getMaxAllocHeap();
+  float fragmentation = freeHeap ? 100.0f * (1.0f - (float)maxBlock / freeHeap) : 0;
+  Serial.printf("[%5d] Free: %lu, MaxBlock: %lu, MinFree: %lu, Fragmentation: %.1f%%\n",
+                sync, freeHeap, maxBlock, ESP.getMinFreeHeap(), fragmentation);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  if (!hublink.begin())
+  {
+    Serial.println("✗ Failed.");
+    while (1)
+    {
+    }
+  }
+
+  // Files of varying name length, so listing entries differ in size
+  fs::FS &fs = hublink.getStorage().fs();
+  for (int i = 0; i < TEST_FILES; i++)
+  {
+    char name[40];
+    snprintf(name, sizeof(name), "/soak_%0*d.csv", 1 + i % 8, i);
+    if (!fs.exists(name))
+    {
+      File file = fs.open(name, FILE_WRITE);
+      for (int line = 0; line <= i; line++)
+      {
+        file.printf("%d,%d\n", line, i);
+      }
+      file.close();
+    }
+  }
+
+  hublink.simulateSync(); // first sync sizes the listing and read-ahead buffers
+  printHeap(0);
+  uint32_t baselineBlock = ESP.getMaxAllocHeap();
+
+  uint32_t start = millis();
+  for (int sync = 1; sync <= SYNCS; sync++)
+  {
+    hublink.simulateSync();
+    if (sync % REPORT_EVERY == 0)
+    {
+      printHeap(sync);
+    }
+  }
+  uint32_t elapsed = millis() - start;
+
+  Serial.printf("%d syncs in %lu ms (%.2f ms/sync)\n", SYNCS, elapsed, (float)elapsed / SYNCS);
+  Serial.printf("Largest free block: %lu -> %lu bytes\n", baselineBlock, ESP.getMaxAllocHeap());
+}
+
+void loop()
+{
+}
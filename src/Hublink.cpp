@@ -3,32 +3,67 @@
 // Define global variables
 Hublink *g_hublink = nullptr;
 
+// Sync scheduler state, retained in RTC slow memory across deep sleep
+RTC_DATA_ATTR static HublinkSchedulerState rtcScheduler;
+
+// Sync time/charge totals, retained across deep sleep
+RTC_DATA_ATTR static HublinkEnergyTotals rtcEnergy;
+
+// Trace events, retained across deep sleep and resets (not power loss); validated by restore()
+RTC_NOINIT_ATTR static HublinkTraceRing<HUBLINK_TRACE_EVENTS_KEPT> rtcTrace;
+
+// Provided by ESP-IDF (esp_hw_support); RTC timer in microseconds, keeps running in deep sleep
+extern "C" uint64_t esp_rtc_get_time_us(void);
+
+uint64_t Hublink::rtcMillis()
+{
+    return esp_rtc_get_time_us() / 1000ULL;
+}
+
 // Define static members
 HublinkServerCallbacks Hublink::serverCallbacks;
 HublinkFilenameCallbacks Hublink::filenameCallbacks;
 HublinkGatewayCallbacks Hublink::gatewayCallbacks;
+HublinkMetaUploadCallbacks Hublink::metaUploadCallbacks;
 
 Hublink::Hublink(uint8_t chipSelect, uint32_t clockFrequency)
     : cs(chipSelect),
-      clkFreq(clockFrequency),
+      clkFreq(clockFrequency == HUBLINK_SD_CLOCK_AUTO ? SD_CLOCK_STEPS[0] : clockFrequency),
+      sdClockAuto(clockFrequency == HUBLINK_SD_CLOCK_AUTO),
+      sdStorage(chipSelect, clockFrequency == HUBLINK_SD_CLOCK_AUTO ? SD_CLOCK_STEPS[0] : clockFrequency),
+      storage(&sdStorage),
       piReadyForFilenames(false),
       deviceConnected(false),
-      currentFileName(""),
-      allFilesSent(false),
       watchdogTimer(0),
-      sendFilenames(false),
+      scheduler(rtcScheduler),
+      energy(rtcEnergy),
+      trace(rtcTrace),
       metaDoc(META_DOC_SIZE) // Initialize with capacity
 {
     g_hublink = this; // Set the global pointer
+    trace.restore();
 }
 
 bool Hublink::begin(String advName)
 {
+    if (!storageMutex)
+    {
+        storageMutex = xSemaphoreCreateRecursiveMutex();
+    }
+    if (!stateMutex)
+    {
+        stateMutex = xSemaphoreCreateRecursiveMutex();
+    }
+    if (!metaMutex)
+    {
+        metaMutex = xSemaphoreCreateRecursiveMutex();
+    }
+
     if (doDebug)
     {
         Serial1.begin(115200);
     }
-    debug(DebugByte::HUBLINK_BEGIN_FUNC);
+    debugValue(DebugByte::HUBLINK_BEGIN_FUNC, esp_reset_reason());
 
     // Get and send wake-up reason
     esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
@@ -67,15 +102,8 @@ bool Hublink::begin(String advName)
     }
     Serial.println("✓ SD Card.");
 
-    // Reset to defaults
-    advertise_every = DEFAULT_ADVERTISE_EVERY;
-    advertise_for = DEFAULT_ADVERTISE_FOR;
-    disable = DEFAULT_DISABLE;
-    upload_path = DEFAULT_UPLOAD_PATH;
-    append_path = DEFAULT_APPEND_PATH;
-    try_reconnect = DEFAULT_TRY_RECONNECT;
-    reconnect_attempts = DEFAULT_RECONNECT_ATTEMPTS;
-    reconnect_every = DEFAULT_RECONNECT_EVERY;
+    // Undo settings a previous begin() took from meta.json; values set in code are kept
+    revertMetaSettings();
 
     // Read meta.json, store in doc, set hublink variables
     debug(DebugByte::HUBLINK_META_JSON_READ);
@@ -89,117 +117,122 @@ bool Hublink::begin(String advName)
     Serial.printf("Device MAC: %02X:%02X:%02X:%02X:%02X:%02X\n",
                   mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 
-    lastHublinkMillis = millis();
+    // Scheduler state survives deep sleep; start a fresh schedule after power-on or reset
+    if (energy.magic != ENERGY_MAGIC)
+    {
+        energy = HublinkEnergyTotals();
+        energy.magic = ENERGY_MAGIC;
+        energy.lastSyncEndMs = rtcMillis();
+    }
+    if (scheduler.magic != SCHEDULER_MAGIC)
+    {
+        scheduler = HublinkSchedulerState();
+        scheduler.magic = SCHEDULER_MAGIC;
+        scheduler.lastSyncMs = rtcMillis();
+    }
     initialized = true;
+    recordMemStats(MemPhase::BEGIN);
     debug(DebugByte::HUBLINK_END_FUNC);
+    flushTrace();
     return true;
 }
 
-String Hublink::sanitizePath(const String &path)
+// Fields meta.json set go back to their earlier values; the others are taken as the new baseline
+template <typename T>
+static void revertMetaKey(uint16_t applied, uint16_t key, T &field, T &baseline)
 {
-    String sanitized = "";
-    for (char c : path)
-    {
-        // Allow alphanumeric, hyphen, underscore, plus, period
-        if (isalnum(c) || c == '-' || c == '_' || c == '+' || c == '.' || c == '/')
-        {
-            sanitized += c;
-        }
-    }
-
-    // Replace multiple consecutive slashes with a single slash
-    while (sanitized.indexOf("//") != -1)
+    if (applied & key)
     {
-        sanitized.replace("//", "/");
+        field = baseline;
     }
-
-    // Remove trailing slash if present
-    while (sanitized.endsWith("/"))
+    else
     {
-        sanitized = sanitized.substring(0, sanitized.length() - 1);
+        baseline = field;
     }
+}
 
-    return sanitized;
+void Hublink::revertMetaSettings()
+{
+    revertMetaKey(metaAppliedKeys, META_KEY_ADVERTISE_EVERY, advertise_every, metaBaseline.advertise_every);
+    revertMetaKey(metaAppliedKeys, META_KEY_ADVERTISE_FOR, advertise_for, metaBaseline.advertise_for);
+    revertMetaKey(metaAppliedKeys, META_KEY_DISABLE, disable, metaBaseline.disable);
+    revertMetaKey(metaAppliedKeys, META_KEY_UPLOAD_PATH, upload_path, metaBaseline.upload_path);
+    revertMetaKey(metaAppliedKeys, META_KEY_APPEND_PATH, append_path, metaBaseline.append_path);
+    revertMetaKey(metaAppliedKeys, META_KEY_TRY_RECONNECT, try_reconnect, metaBaseline.try_reconnect);
+    revertMetaKey(metaAppliedKeys, META_KEY_RECONNECT_ATTEMPTS, reconnect_attempts, metaBaseline.reconnect_attempts);
+    revertMetaKey(metaAppliedKeys, META_KEY_RECONNECT_EVERY, reconnect_every, metaBaseline.reconnect_every);
+    revertMetaKey(metaAppliedKeys, META_KEY_COMMIT_POLICY, commit_policy, metaBaseline.commit_policy);
+    revertMetaKey(metaAppliedKeys, META_KEY_SHARD_MODE, shard_mode, metaBaseline.shard_mode);
+    revertMetaKey(metaAppliedKeys, META_KEY_SHARD_SIZE, shard_size, metaBaseline.shard_size);
+    metaAppliedKeys = 0;
 }
 
-String Hublink::getNestedJsonValue(const JsonDocument &doc, const String &path)
+// Re-read meta.json after an upload and apply it without restarting the BLE stack.
+// Keys the previous meta.json set revert first, so removed keys go back to their code or
+// default values and append_path is not applied twice; other fields keep what the sketch set.
+void Hublink::applyMetaJsonSettings()
 {
-    // Split path into parts (e.g., "subject:id" -> ["subject", "id"])
-    int colonPos = path.indexOf(':');
-    if (colonPos == -1)
-        return "";
+    PhaseScope phase(*this, SyncPhase::META_JSON);
+    metaJsonUpdated = false;
+    debug(DebugByte::HUBLINK_META_JSON_READ);
 
-    String parent = path.substring(0, colonPos);
-    String child = path.substring(colonPos + 1);
+    MutexGuard guard(metaMutex); // loop() may call getMeta() meanwhile
+    revertMetaSettings();
+    readMetaJson();
+    if (metaAppliedKeys & META_KEY_ADVERTISE_FOR)
+    {
+        temporaryAdvertiseFor = 0; // an uploaded advertise_for replaces the temporary duration
+    }
+    invalidateListing(); // file_extensions may have changed
 
-    // Check if parent exists and has child
-    if (doc.containsKey(parent) && doc[parent].containsKey(child))
+    // Keep the retry scheduler consistent with the new limits
+    if (!try_reconnect || scheduler.currentRetryAttempt > reconnect_attempts)
     {
-        String value = doc[parent][child].as<String>();
-        // Return empty string if the value is empty or only whitespace
-        value.trim();
-        return value;
+        scheduler.connectionAttempted = false;
+        scheduler.currentRetryAttempt = 0;
     }
 
-    return "";
+    updateNodeCharacteristic();
 }
 
-String Hublink::processAppendPath(const JsonDocument &doc, const String &basePath, const String &appendPath)
+void Hublink::updateNodeCharacteristic()
 {
-    String finalPath = basePath;
-
-    // Split append_path by '/'
-    int startPos = 0;
-    int slashPos;
-
-    while ((slashPos = appendPath.indexOf('/', startPos)) != -1 || startPos < appendPath.length())
+    if (pNodeCharacteristic == nullptr)
     {
-        // Extract the current pair
-        String pair;
-        { // Create scope for temporary String management
-            if (slashPos == -1)
-            {
-                pair = appendPath.substring(startPos);
-                startPos = appendPath.length();
-            }
-            else
-            {
-                pair = appendPath.substring(startPos, slashPos);
-                startPos = slashPos + 1;
-            }
-
-            // Get and validate the nested value
-            String value = getNestedJsonValue(doc, pair);
-            if (value.length() > 0)
-            {
-                // Add separator if needed
-                if (!finalPath.endsWith("/"))
-                {
-                    finalPath += "/";
-                }
-                finalPath += value;
-            }
-
-            // Let Strings go out of scope naturally
-        }
+        return;
     }
+    String nodeJson = buildNodeCharacteristicJson();
+    pNodeCharacteristic->setValue(nodeJson.c_str());
+}
 
-    // Sanitize and return the complete path
-    String result = sanitizePath(finalPath);
-    finalPath = ""; // Clear the string
-
-    return result;
+// Returns true if resolvedUploadPath holds basePath + append_path for doc.
+// Only compiling append_path is cached; resolving is a single pass over the tokens.
+bool Hublink::resolveUploadPath(const JsonDocument &doc, const char *basePath)
+{
+    if (!appendPathResolver.matches(append_path.c_str()) && !appendPathResolver.compile(append_path.c_str()))
+    {
+        Serial.println("Warning: append_path too long, ignoring");
+        return false;
+    }
+    if (!appendPathResolver.resolve(doc, basePath, resolvedUploadPath, sizeof(resolvedUploadPath)))
+    {
+        Serial.println("Warning: resolved upload_path too long, ignoring append_path");
+        return false;
+    }
+    return true;
 }
 
 String Hublink::readMetaJson()
 {
+    PhaseScope phase(*this, SyncPhase::META_JSON);
+    MutexGuard guard(metaMutex);
     if (!beginSD())
     {
         Serial.println("Failed to initialize SD card when reading meta.json");
         return "";
     }
 
-    File configFile = SD.open(META_JSON_PATH, FILE_READ);
+    File configFile = files().open(META_JSON_PATH, FILE_READ);
     if (!configFile)
     {
         Serial.println("No meta.json file found, using defaults");
@@ -217,7 +250,7 @@ String Hublink::readMetaJson()
         return "";
     }
 
-    DynamicJsonDocument doc(capacity);
+    HublinkJsonDocument doc(capacity);
     DeserializationError error = deserializeJson(doc, configFile);
     configFile.close();
 
@@ -228,6 +261,7 @@ String Hublink::readMetaJson()
         metaDocValid = false;
         return "";
     }
+    recordMemStats(MemPhase::READ_META_JSON); // with the parse document still held
 
     try
     {
@@ -251,6 +285,10 @@ String Hublink::readMetaJson()
     JsonObject hublink = doc["hublink"];
     String content = "";
 
+    // append_path always extends the upload_path from before it was applied, so re-reading
+    // meta.json (getMeta(), patches) does not append the same segments again
+    String basePath = (metaAppliedKeys & META_KEY_UPLOAD_PATH) ? metaBaseline.upload_path : upload_path;
+
     // Validate fields before access (only before begin() finishes; afterward begin(advName) owns advertise)
     if (hublink.containsKey("advertise") && !initialized)
     {
@@ -262,11 +300,13 @@ String Hublink::readMetaJson()
         String path = hublink["upload_path"].as<String>();
         if (path.length() > 0 && path.length() <= 128)
         {
+            metaAppliedKeys |= META_KEY_UPLOAD_PATH;
             upload_path = path;
             if (!upload_path.startsWith("/"))
             {
                 upload_path = "/" + upload_path;
             }
+            basePath = upload_path;
             Serial.printf("Set upload_path from meta.json: %s\n", upload_path.c_str());
         }
     }
@@ -274,12 +314,18 @@ String Hublink::readMetaJson()
     // Handle append_path if it exists
     if (hublink.containsKey("append_path"))
     {
-        String appendPath = hublink["append_path"].as<String>();
-        if (appendPath.length() > 0)
+        metaAppliedKeys |= META_KEY_APPEND_PATH;
+        append_path = hublink["append_path"].as<String>();
+        if (append_path.length() > 0 && resolveUploadPath(doc, basePath.c_str()))
         {
-            upload_path = processAppendPath(doc, upload_path, appendPath);
+            metaAppliedKeys |= META_KEY_UPLOAD_PATH;
+            upload_path = resolvedUploadPath;
             Serial.printf("Final upload_path: %s\n", upload_path.c_str());
         }
+        else
+        {
+            upload_path = basePath; // drop segments an earlier read appended
+        }
     }
 
     if (hublink.containsKey("advertise_every") && hublink.containsKey("advertise_for"))
@@ -289,6 +335,7 @@ String Hublink::readMetaJson()
 
         if (newEvery > 0 && newFor > 0)
         {
+            metaAppliedKeys |= META_KEY_ADVERTISE_EVERY | META_KEY_ADVERTISE_FOR;
             advertise_every = newEvery;
             advertise_for = newFor;
             Serial.printf("Updated intervals: every=%d, for=%d\n", advertise_every, advertise_for);
@@ -298,6 +345,7 @@ String Hublink::readMetaJson()
     // Add new retry configuration parsing
     if (hublink.containsKey("try_reconnect"))
     {
+        metaAppliedKeys |= META_KEY_TRY_RECONNECT;
         try_reconnect = hublink["try_reconnect"].as<bool>();
         Serial.printf("Retry enabled: %s\n", try_reconnect ? "true" : "false");
     }
@@ -307,6 +355,7 @@ String Hublink::readMetaJson()
         uint8_t attempts = hublink["reconnect_attempts"].as<uint8_t>();
         if (attempts > 0)
         {
+            metaAppliedKeys |= META_KEY_RECONNECT_ATTEMPTS;
             reconnect_attempts = attempts;
             Serial.printf("Retry attempts set to: %d\n", reconnect_attempts);
         }
@@ -317,13 +366,53 @@ String Hublink::readMetaJson()
         uint32_t every = hublink["reconnect_every"].as<uint32_t>();
         if (every > 0)
         {
+            metaAppliedKeys |= META_KEY_RECONNECT_EVERY;
             reconnect_every = every; // Keep in seconds
             Serial.printf("Retry interval set to: %d seconds\n", every);
         }
     }
 
+    if (hublink.containsKey("commit_policy"))
+    {
+        String policy = hublink["commit_policy"].as<String>();
+        metaAppliedKeys |= META_KEY_COMMIT_POLICY;
+        if (policy == "none")
+            commit_policy = CommitPolicy::NONE;
+        else if (policy == "archive")
+            commit_policy = CommitPolicy::ARCHIVE;
+        else if (policy == "delete")
+            commit_policy = CommitPolicy::DELETE;
+        else if (policy == "manifest")
+            commit_policy = CommitPolicy::MANIFEST;
+        Serial.printf("Commit policy set to: %s\n", policy.c_str());
+    }
+
+    if (hublink.containsKey("shard_mode"))
+    {
+        String mode = hublink["shard_mode"].as<String>();
+        metaAppliedKeys |= META_KEY_SHARD_MODE;
+        if (mode == "none")
+            shard_mode = ShardMode::NONE;
+        else if (mode == "day")
+            shard_mode = ShardMode::DAY;
+        else if (mode == "count")
+            shard_mode = ShardMode::COUNT;
+        Serial.printf("Shard mode set to: %s\n", mode.c_str());
+    }
+
+    if (hublink.containsKey("shard_size"))
+    {
+        uint16_t size = hublink["shard_size"].as<uint16_t>();
+        if (size > 0)
+        {
+            metaAppliedKeys |= META_KEY_SHARD_SIZE;
+            shard_size = size;
+        }
+    }
+
     if (hublink.containsKey("disable"))
     {
+        metaAppliedKeys |= META_KEY_DISABLE;
         disable = hublink["disable"].as<bool>();
         Serial.printf("BLE disable flag set to: %s\n", disable ? "true" : "false");
     }
@@ -343,20 +432,119 @@ void Hublink::setCPUFrequency(CPUFrequency freq_mhz)
     setCpuFrequencyMhz(static_cast<uint32_t>(freq_mhz));
 }
 
+void Hublink::beginCpuPolicy()
+{
+    if (!auto_cpu_frequency || cpuPolicyActive)
+    {
+        return;
+    }
+    cpuRestoreMhz = getCpuFrequencyMhz();
+    cpuBoostDepth = 0;
+
+    // Let power management scale between idle and boost; keep the app's light sleep setting
+    HublinkPmConfig config = {};
+    bool pmAvailable = esp_pm_get_configuration(&config) == ESP_OK;
+    cpuRestorePm = config; // the app's own range and light sleep setting, put back unchanged
+    config.max_freq_mhz = CPU_BOOST_MHZ;
+    config.min_freq_mhz = CPU_IDLE_MHZ;
+    if (cpuBoostLock == nullptr)
+    {
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "hublink_boost", &cpuBoostLock);
+    }
+    cpuPolicyUsesPm = pmAvailable && cpuBoostLock != nullptr && esp_pm_configure(&config) == ESP_OK;
+    if (!cpuPolicyUsesPm)
+    {
+        setCpuFrequencyMhz(CPU_IDLE_MHZ); // no power management in this build: switch directly
+    }
+    cpuPolicyActive = true;
+}
+
+void Hublink::endCpuPolicy()
+{
+    if (!cpuPolicyActive)
+    {
+        return;
+    }
+    while (cpuBoostDepth > 0)
+    {
+        cpuRelax(); // a scope left open would pin the clock
+    }
+    cpuPolicyActive = false;
+    if (cpuPolicyUsesPm)
+    {
+        esp_pm_configure(&cpuRestorePm);
+    }
+    else
+    {
+        setCpuFrequencyMhz(cpuRestoreMhz);
+    }
+}
+
+void Hublink::cpuBoost()
+{
+    if (!cpuPolicyActive)
+    {
+        return;
+    }
+    if (cpuBoostDepth++ == 0)
+    {
+        if (cpuPolicyUsesPm)
+        {
+            esp_pm_lock_acquire(cpuBoostLock);
+        }
+        else
+        {
+            setCpuFrequencyMhz(CPU_BOOST_MHZ);
+        }
+    }
+}
+
+void Hublink::cpuRelax()
+{
+    if (!cpuPolicyActive || cpuBoostDepth == 0)
+    {
+        return;
+    }
+    if (--cpuBoostDepth == 0)
+    {
+        if (cpuPolicyUsesPm)
+        {
+            esp_pm_lock_release(cpuBoostLock);
+        }
+        else
+        {
+            setCpuFrequencyMhz(CPU_IDLE_MHZ);
+        }
+    }
+}
+
 void Hublink::startAdvertising()
 {
     debug(DebugByte::HUBLINK_BLE_INIT_START, true);
+    unsigned long startMicros = micros();
+
+    // Persistent mode: stack and GATT database are still up, only restart advertising
+    if (persistentBLE && pServer != nullptr && NimBLEDevice::isInitialized() && bleInitName == advertise)
+    {
+        attachCallbacks();
+        updateNodeCharacteristic();
+        debug(DebugByte::HUBLINK_BLE_ADV_START, true);
+        NimBLEDevice::getAdvertising()->start();
+        lastBLEStartMicros = micros() - startMicros;
+        recordMemStats(MemPhase::START_ADVERTISING);
+        Serial.printf("BLE start (persistent): %lu us\n", lastBLEStartMicros);
+        return;
+    }
 
     if (NimBLEDevice::isInitialized())
     {
         Serial.println("TEMP Hublink startAdvertising: NimBLE already initialized, deinit before init");
-        NimBLEDevice::deinit(true);
-        delay(100);
-        clearNimbleBlePointers();
+        teardownBLE();
     }
 
     Serial.println("TEMP Hublink startAdvertising: NimBLEDevice::init");
     NimBLEDevice::init(advertise.c_str());
+    bleInitName = advertise;
 
     debug(DebugByte::HUBLINK_BLE_INIT_POWER, true);
     NimBLEDevice::setPower(ESP_PWR_LVL_P9);
@@ -369,17 +557,12 @@ void Hublink::startAdvertising()
         debug(DebugByte::HUBLINK_BLE_ERROR);
         Serial.println("Failed to create server!");
         Serial.println("TEMP Hublink startAdvertising: createServer failed, deinit and clear pointers");
-        cleanupCallbacks();
-        if (NimBLEDevice::isInitialized())
-        {
-            NimBLEDevice::deinit(true);
-            delay(100);
-        }
-        clearNimbleBlePointers();
+        teardownBLE();
         return;
     }
 
-    pServer->setCallbacks(&serverCallbacks);
+    // stopAdvertising() owns restarts; never re-advertise behind its back
+    pServer->advertiseOnDisconnect(false);
 
     debug(DebugByte::HUBLINK_BLE_CREATE_SERVICE, true);
     pService = pServer->createService(SERVICE_UUID);
@@ -390,7 +573,6 @@ void Hublink::startAdvertising()
     pFilenameCharacteristic = pService->createCharacteristic(
         CHARACTERISTIC_UUID_FILENAME,
         NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::INDICATE);
-    pFilenameCharacteristic->setCallbacks(&filenameCallbacks);
 
     debug(DebugByte::HUBLINK_BLE_CREATE_CHAR_TRANSFER, true);
     pFileTransferCharacteristic = pService->createCharacteristic(
@@ -401,16 +583,22 @@ void Hublink::startAdvertising()
     pConfigCharacteristic = pService->createCharacteristic(
         CHARACTERISTIC_UUID_GATEWAY,
         NIMBLE_PROPERTY::WRITE);
-    pConfigCharacteristic->setCallbacks(&gatewayCallbacks);
 
     debug(DebugByte::HUBLINK_BLE_CREATE_CHAR_NODE, true);
     pNodeCharacteristic = pService->createCharacteristic(
         CHARACTERISTIC_UUID_NODE,
         NIMBLE_PROPERTY::READ);
 
+    debug(DebugByte::HUBLINK_BLE_CREATE_CHAR_META_UPLOAD, true);
+    pMetaUploadCharacteristic = pService->createCharacteristic(
+        CHARACTERISTIC_UUID_META_UPLOAD,
+        NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR | NIMBLE_PROPERTY::NOTIFY);
+
+    attachCallbacks();
+
     String nodeJson = buildNodeCharacteristicJson();
     pNodeCharacteristic->setValue(nodeJson.c_str());
-    Serial.printf("Node characteristic value: %s\n", nodeJson.c_str());
+    HUBLINK_LOGV("Node characteristic value: %s\n", nodeJson.c_str());
 
     debug(DebugByte::HUBLINK_BLE_START_SERVICE, true);
     pService->start();
@@ -441,10 +629,14 @@ void Hublink::startAdvertising()
 
     debug(DebugByte::HUBLINK_BLE_ADV_START, true);
     pAdvertising->start();
+    lastBLEStartMicros = micros() - startMicros;
+    recordMemStats(MemPhase::START_ADVERTISING);
+    Serial.printf("BLE start (full init): %lu us\n", lastBLEStartMicros);
 }
 
 void Hublink::stopAdvertising()
 {
+    unsigned long startMicros = micros();
     if (NimBLEDevice::isInitialized())
     {
         Serial.println("TEMP Hublink stopAdvertising: NimBLE initialized, stopping advertising");
@@ -453,17 +645,26 @@ void Hublink::stopAdvertising()
             // First disconnect any connected clients
             if (pServer->getConnectedCount() > 0)
             {
-                pServer->disconnect(0);
+                for (uint16_t connHandle : pServer->getPeerDevices())
+                {
+                    pServer->disconnect(connHandle);
+                }
                 delay(50);
             }
 
-            cleanupCallbacks();
-            delay(20);
+            if (!persistentBLE)
+            {
+                cleanupCallbacks();
+                delay(20);
+            }
         }
 
         // Only use NimBLE
         NimBLEDevice::getAdvertising()->stop();
-        delay(50);
+        if (!persistentBLE)
+        {
+            delay(50);
+        }
     }
     else
     {
@@ -471,16 +672,55 @@ void Hublink::stopAdvertising()
     }
 
     resetBLEState();
-    delay(20);
 
+    if (!persistentBLE)
+    {
+        teardownBLE();
+    }
+    lastBLEStopMicros = micros() - startMicros;
+    recordMemStats(MemPhase::STOP_ADVERTISING);
+    Serial.printf("BLE stop (%s): %lu us\n", persistentBLE ? "persistent" : "deinit", lastBLEStopMicros);
+}
+
+void Hublink::endBLE()
+{
+    stopAdvertising();
+    teardownBLE();
+}
+
+// Full NimBLE shutdown; callbacks are removed first so deinit cannot reach dangling references
+void Hublink::teardownBLE()
+{
     if (NimBLEDevice::isInitialized())
     {
+        cleanupCallbacks();
+        delay(20);
         Serial.println("TEMP Hublink stopAdvertising: deinit(true)");
         NimBLEDevice::deinit(true);
         delay(100);
     }
-
     clearNimbleBlePointers();
+    bleInitName = "";
+}
+
+void Hublink::attachCallbacks()
+{
+    if (pServer != nullptr)
+    {
+        pServer->setCallbacks(&serverCallbacks);
+    }
+    if (pFilenameCharacteristic != nullptr)
+    {
+        pFilenameCharacteristic->setCallbacks(&filenameCallbacks);
+    }
+    if (pConfigCharacteristic != nullptr)
+    {
+        pConfigCharacteristic->setCallbacks(&gatewayCallbacks);
+    }
+    if (pMetaUploadCharacteristic != nullptr)
+    {
+        pMetaUploadCharacteristic->setCallbacks(&metaUploadCallbacks);
+    }
 }
 
 void Hublink::cleanupCallbacks()
@@ -498,6 +738,10 @@ void Hublink::cleanupCallbacks()
     {
         pConfigCharacteristic->setCallbacks(nullptr);
     }
+    if (pMetaUploadCharacteristic != nullptr)
+    {
+        pMetaUploadCharacteristic->setCallbacks(nullptr);
+    }
 }
 
 void Hublink::clearNimbleBlePointers()
@@ -508,188 +752,1545 @@ void Hublink::clearNimbleBlePointers()
     pFileTransferCharacteristic = nullptr;
     pConfigCharacteristic = nullptr;
     pNodeCharacteristic = nullptr;
+    pMetaUploadCharacteristic = nullptr;
 }
 
-// SD.begin(cs, SPI, clkFreq) only if not already mounted (e.g. sketch initialized SD first).
+// Mounts the storage backend only if not already mounted (e.g. sketch initialized SD first).
+// Once the mount is known good this returns immediately; it re-probes only after markSDError()
+// or a card-detect change.
 bool Hublink::beginSD()
 {
-    if (SD.cardType() == CARD_NONE)
+    MutexGuard guard(storageMutex); // a background sync may re-mount while loop() writes
+    if (cardDetectPin >= 0)
+    {
+        bool present = digitalRead(cardDetectPin) == cardDetectActiveLevel;
+        if (present != cardPresent)
+        {
+            Serial.printf("SD card %s\n", present ? "inserted" : "removed");
+            cardPresent = present;
+            sdMountHealthy = false;
+            sdNeedsRemount = present;
+        }
+        if (!present)
+        {
+            debug(DebugByte::HUBLINK_SD_ERROR);
+            return false;
+        }
+    }
+
+    if (sdMountHealthy)
+    {
+        return true;
+    }
+
+    if (sdNeedsRemount)
+    {
+        storage->end();
+        sdRemountCount++;
+        shardIndexLoaded = false; // the card may have been swapped
+        Serial.printf("SD re-mount #%lu\n", sdRemountCount);
+
+        // Errors at a negotiated clock step back one level and never climb above it again
+        if (storage == &sdStorage && sdClockAuto && sdClockStep > 0)
+        {
+            sdClockStep--;
+            sdClockCeiling = sdClockStep;
+            clkFreq = SD_CLOCK_STEPS[sdClockStep];
+            Serial.printf("SD clock fallback to %lu Hz\n", clkFreq);
+        }
+    }
+
+    if (!storage->isMounted())
     {
-        if (!SD.begin(cs, SPI, clkFreq))
+        bool mounted;
+        if (storage == &sdStorage)
+        {
+            mounted = (sdClockAuto && !sdClockNegotiated) ? negotiateSDClock() : sdStorage.begin(clkFreq);
+            sdClockManaged = mounted;
+        }
+        else
+        {
+            mounted = storage->begin();
+        }
+        if (!mounted)
         {
             debug(DebugByte::HUBLINK_SD_ERROR);
+            sdNeedsRemount = true;
             return false;
         }
     }
     // trick to enter SD idle state
-    File r = SD.open("/", FILE_READ);
+    File r = files().open("/", FILE_READ);
     if (!r)
     {
+        sdNeedsRemount = true;
         return false;
     }
     r.close();
+    sdMountHealthy = true;
+    sdNeedsRemount = false;
     debug(DebugByte::HUBLINK_SD_CONNECT);
     return true;
 }
 
-void Hublink::sendAvailableFilenames()
+static void fillScratchPattern(uint8_t *buffer, size_t length, uint32_t seed)
 {
-    if (!rootFileOpen)
+    for (size_t i = 0; i < length; i++)
     {
-        Serial.println("Invalid root directory handle");
-        return;
+        seed = seed * 1103515245UL + 12345UL; // LCG; varied bits catch bit-slips at high clocks
+        buffer[i] = (uint8_t)(seed >> 16);
     }
+}
 
-    String accumulatedFileInfo = "";
-    while (deviceConnected)
-    {
-        watchdogTimer = millis();
-        debug(DebugByte::HUBLINK_FILE_ENTRY_OPEN);
-        File entry = rootFile.openNextFile();
-        if (!entry)
-        {
-            int index = 0;
-            while (index < accumulatedFileInfo.length() && deviceConnected)
-            {
-                watchdogTimer = millis();
-                String chunk = accumulatedFileInfo.substring(index, index + mtuSize);
-                Serial.println("Indicating filename chunk: " + chunk);
-                if (!sendIndication(pFilenameCharacteristic, (uint8_t *)chunk.c_str(), chunk.length()))
-                {
-                    debug(DebugByte::HUBLINK_TRANSFER_INDICATION_FAIL);
-                    Serial.println("Failed to send indication");
-                    break;
-                }
-                index += mtuSize;
-            }
-            // Send "EOF" as a separate indication to signal the end
-            if (!sendIndication(pFilenameCharacteristic, (uint8_t *)"EOF", 3))
-            {
-                debug(DebugByte::HUBLINK_TRANSFER_INDICATION_FAIL);
-                Serial.println("Failed to send EOF indication");
-            }
-            else
-            {
-                debug(DebugByte::HUBLINK_TRANSFER_EOF_SENT);
-            }
-            allFilesSent = true;
-            accumulatedFileInfo = ""; // Clear the accumulated string
-            break;
-        }
+bool Hublink::mountSDAt(uint32_t frequency)
+{
+    sdStorage.end();
+    return sdStorage.begin(frequency);
+}
 
-        debug(DebugByte::HUBLINK_FILE_ENTRY_PROCESS);
-        String fileName = entry.name();
-        if (isValidFile(fileName))
-        {
-            String fileInfo = fileName + "|" + String(entry.size());
-            if (!accumulatedFileInfo.isEmpty())
-            {
-                accumulatedFileInfo += ";";
-            }
-            accumulatedFileInfo += fileInfo;
-        }
-        entry.close();
+bool Hublink::verifySDScratch()
+{
+    uint8_t expected[SD_SCRATCH_SIZE];
+    uint8_t actual[SD_SCRATCH_SIZE];
+    fillScratchPattern(expected, sizeof(expected), SD_SCRATCH_SEED);
+
+    File scratch = files().open(SD_SCRATCH_PATH, FILE_READ);
+    if (!scratch)
+    {
+        return false;
     }
+    size_t bytesRead = scratch.read(actual, sizeof(actual));
+    scratch.close();
+    return bytesRead == sizeof(actual) && memcmp(expected, actual, sizeof(actual)) == 0;
 }
 
-void Hublink::handleFileTransfer(String fileName)
+// Mount at the lowest step, write a scratch pattern, then step the clock up and read it back.
+// The highest step that reads back intact is kept.
+bool Hublink::negotiateSDClock()
 {
-    if (!pFileTransferCharacteristic)
+    sdClockStep = 0;
+    clkFreq = SD_CLOCK_STEPS[0];
+    if (!mountSDAt(clkFreq))
     {
-        Serial.println("Warning: Null transfer characteristic");
-        return;
+        return false;
     }
-    // Check if transfer file is valid
-    if (!transferFileOpen) // Changed from checking transferFile directly
+    sdClockNegotiated = true;
+
+    uint8_t pattern[SD_SCRATCH_SIZE];
+    fillScratchPattern(pattern, sizeof(pattern), SD_SCRATCH_SEED);
+    if (!verifySDScratch())
     {
-        Serial.printf("Failed to use file: %s\n", fileName.c_str());
-        if (!sendIndication(pFileTransferCharacteristic, (uint8_t *)"NFF", 3))
+        File scratch = files().open(SD_SCRATCH_PATH, FILE_WRITE);
+        bool written = scratch && scratch.write(pattern, sizeof(pattern)) == sizeof(pattern);
+        if (scratch)
         {
-            Serial.println("Failed to send NFF (no file found) indication");
+            scratch.close();
+        }
+        if (!written || !verifySDScratch())
+        {
+            Serial.printf("SD clock: scratch write failed, staying at %lu Hz\n", clkFreq);
+            return true;
         }
-        return;
     }
 
-    uint8_t buffer[mtuSize];
-    while (transferFile.available() && deviceConnected)
+    uint8_t best = 0;
+    for (uint8_t step = 1; step <= sdClockCeiling && step < SD_CLOCK_STEP_COUNT; step++)
     {
-        watchdogTimer = millis();
-        int bytesRead = transferFile.read(buffer, mtuSize);
-
-        if (bytesRead > 0)
-        {
-            if (!sendIndication(pFileTransferCharacteristic, buffer, bytesRead))
-            {
-                Serial.println("Failed to send file chunk indication");
-                break;
-            }
-        }
-        else
+        if (!mountSDAt(SD_CLOCK_STEPS[step]) || !verifySDScratch())
         {
-            Serial.println("Error reading from file.");
             break;
         }
+        best = step;
     }
-    if (!sendIndication(pFileTransferCharacteristic, (uint8_t *)"EOF", 3))
+
+    // Re-mount at the best step if the last attempt was above it
+    if (best + 1 < SD_CLOCK_STEP_COUNT && best < sdClockCeiling)
     {
-        Serial.println("Failed to send EOF indication");
+        if (!mountSDAt(SD_CLOCK_STEPS[best]))
+        {
+            sdClockNegotiated = false;
+            return false;
+        }
     }
-    Serial.println("File transfer complete.");
+    sdClockStep = best;
+    clkFreq = SD_CLOCK_STEPS[best];
+    Serial.printf("SD clock negotiated: %lu Hz\n", clkFreq);
+    return true;
 }
 
-bool Hublink::isValidFile(String fileName)
+// Called on SD I/O failures; the next beginSD() re-probes and, if needed, re-mounts the card.
+// At a negotiated clock above the lowest step the error forces the re-mount, which steps down.
+void Hublink::markSDError()
 {
-    // Exclude files that start with a dot
-    if (fileName.startsWith("."))
+    if (sdMountHealthy)
     {
-        return false;
+        debug(DebugByte::HUBLINK_SD_ERROR);
+        sdMountHealthy = false;
     }
-
-    // Convert filename to lowercase
-    String lowerFileName = fileName;
-    lowerFileName.toLowerCase();
-
-    // Check for valid extensions
-    for (const auto &ext : validExtensions) // Use range-based for loop
+    if (storage == &sdStorage && sdClockAuto && sdClockManaged && sdClockStep > 0)
     {
-        if (lowerFileName.endsWith(ext))
-        {
-            return true;
-        }
+        sdNeedsRemount = true;
     }
-    return false;
 }
 
-void Hublink::onConnect()
+void Hublink::setStorage(HublinkStorage &backend)
+{
+    storage = &backend;
+    sdMountHealthy = false;
+    sdNeedsRemount = false;
+    sdClockManaged = false;
+    Serial.printf("Storage backend: %s\n", backend.name());
+}
+
+void Hublink::setCardDetectPin(int8_t pin, uint8_t activeLevel)
+{
+    cardDetectPin = pin;
+    cardDetectActiveLevel = activeLevel;
+    if (pin >= 0)
+    {
+        pinMode(pin, INPUT_PULLUP);
+        cardPresent = digitalRead(pin) == activeLevel;
+    }
+    sdMountHealthy = false;
+}
+
+// Appends "name|size" entries to stagedListing, at most budgetMs at a time (0 = until done).
+// Returns true once the root and shard listing is complete.
+bool Hublink::stageListing(unsigned long budgetMs)
+{
+    if (listingStaged)
+    {
+        return true;
+    }
+    PhaseScope phase(*this, SyncPhase::LISTING);
+    CpuBoostScope boost(*this);
+
+    if (!rootFileOpen)
+    {
+        debug(DebugByte::HUBLINK_FILE_OPEN);
+        rootFile = files().open("/");
+        if (!rootFile)
+        {
+            debug(DebugByte::HUBLINK_SD_ROOT_ERROR);
+            Serial.println("Failed to open root directory");
+            markSDError();
+            return false;
+        }
+        rootFileOpen = true;
+        stagedListing = ""; // keeps its capacity, so a listing of similar size does not reallocate
+        stagedListing.reserve(LISTING_RESERVE);
+        liveSnapshots.clear();
+    }
+
+    unsigned long start = millis();
+    while (budgetMs == 0 || millis() - start < budgetMs)
+    {
+        watchdogTimer = millis();
+        debug(DebugByte::HUBLINK_FILE_ENTRY_OPEN);
+        File entry = rootFile.openNextFile();
+        if (!entry)
+        {
+            debug(DebugByte::HUBLINK_FILE_CLOSE);
+            rootFile.close();
+            rootFileOpen = false;
+            appendShardListing(stagedListing);
+            appendTraceListing(stagedListing);
+            listingStaged = true;
+            return true;
+        }
+
+        debug(DebugByte::HUBLINK_FILE_ENTRY_PROCESS);
+        appendListingEntry(stagedListing, entry.name(), entry.size());
+        entry.close();
+    }
+    return false;
+}
+
+// Warm the read-ahead buffer with the start of the first listed file; used once by startTransfer
+void Hublink::prefetchFirstFile()
+{
+    if (prefetchAttempted || !listingStaged)
+    {
+        return;
+    }
+    prefetchAttempted = true;
+
+    int end = stagedListing.indexOf('|');
+    if (end <= 0)
+    {
+        return; // nothing listed
+    }
+    uint8_t *buffer = acquireReadAheadBuffer();
+    if (!buffer)
+    {
+        return;
+    }
+
+    prefetchName = ""; // keeps its capacity
+    prefetchName.concat(stagedListing.c_str(), end);
+    char path[MAX_FILE_PATH];
+    File file = files().open(resolveFilePath(prefetchName.c_str(), path, sizeof(path)), FILE_READ);
+    if (!file)
+    {
+        prefetchName = "";
+        return;
+    }
+    int bytesRead = file.read(buffer, readAheadAllocated);
+    if (bytesRead > 0)
+    {
+        prefetchLength = bytesRead;
+        prefetchFileSize = file.size();
+    }
+    else
+    {
+        prefetchName = "";
+    }
+    file.close();
+}
+
+// Directory contents may have changed (new sync, commit, extensions updated).
+// A gateway part-way through the listing keeps it; it is dropped once that gateway has the EOF.
+void Hublink::invalidateListing()
+{
+    for (const Session &session : sessions)
+    {
+        if (session.listing && session.listingOffset > 0)
+        {
+            listingStale = true;
+            return;
+        }
+    }
+    listingStale = false;
+    if (rootFileOpen)
+    {
+        rootFile.close();
+        rootFileOpen = false;
+    }
+    stagedListing = "";
+    listingStaged = false;
+    liveSnapshots.clear();
+    prefetchAttempted = false;
+    prefetchName = "";
+    prefetchLength = 0;
+}
+
+// One step of a listing request per doBLE() pass: a slice of staging, then one indication, then EOF
+void Hublink::pumpListing(Session &session)
+{
+    PhaseScope phase(*this, SyncPhase::LISTING);
+    session.watchdogTimer = millis();
+    if (session.listingOffset == 0 && listingStale)
+    {
+        return; // another gateway is finishing the old listing; this one gets the new one
+    }
+
+    // Normally staged while advertising; finish (or do) the scan now if the gateway was quicker
+    if (!stageListing(LISTING_STAGE_SLICE_MS))
+    {
+        if (!rootFileOpen && session.boosted)
+        {
+            session.listing = false; // root directory could not be opened
+            session.boosted = false;
+            cpuRelax();
+        }
+        return;
+    }
+
+    // Chunks are indicated straight out of the staged listing, no copies
+    size_t length = stagedListing.length();
+    if (session.listingOffset < length)
+    {
+        size_t chunk = std::min((size_t)session.mtuSize, length - session.listingOffset);
+        const char *listing = stagedListing.c_str() + session.listingOffset;
+        HUBLINK_LOGV("Indicating filename chunk (gateway %u): %.*s\n", session.connHandle, (int)chunk, listing);
+        if (sendIndication(session, pFilenameCharacteristic, (const uint8_t *)listing, chunk))
+        {
+            session.listingOffset += chunk;
+            return;
+        }
+        debug(DebugByte::HUBLINK_TRANSFER_INDICATION_FAIL);
+        Serial.println("Failed to send indication");
+    }
+
+    // Send "EOF" as a separate indication to signal the end
+    if (!sendIndication(session, pFilenameCharacteristic, (uint8_t *)"EOF", 3))
+    {
+        debug(DebugByte::HUBLINK_TRANSFER_INDICATION_FAIL);
+        Serial.println("Failed to send EOF indication");
+    }
+    else
+    {
+        debug(DebugByte::HUBLINK_TRANSFER_EOF_SENT);
+    }
+    session.listingSent = true;
+    session.listing = false;
+    session.listingOffset = 0;
+    if (session.boosted)
+    {
+        session.boosted = false;
+        cpuRelax();
+    }
+    recordMemStats(MemPhase::LISTING);
+    debugValue(DebugByte::HUBLINK_FILE_LIST_END, length);
+    if (listingStale)
+    {
+        invalidateListing(); // a commit during the listing; later requests see the new state
+    }
+}
+
+void Hublink::startTransfer(Session &session, const char *fileName)
+{
+    PhaseScope phase(*this, SyncPhase::TRANSFER);
+    debug(DebugByte::HUBLINK_TRANSFER_START);
+    HUBLINK_LOGV("Requested file (gateway %u): %s\n", session.connHandle, fileName);
+    updateMtuSize(session);
+
+    debug(DebugByte::HUBLINK_FILE_OPEN);
+    session.source = nullptr;
+    if (isTraceFile(fileName) && traceFileLength > 0)
+    {
+        session.source = traceFile; // snapshot taken with the listing
+        session.sourceLength = traceFileLength;
+        session.traceEnd = traceFileEnd; // a later listing may take a newer snapshot before the commit
+    }
+    else
+    {
+        PhaseScope io(*this, SyncPhase::SD_IO);
+        char path[MAX_FILE_PATH];
+        session.file = files().open(resolveFilePath(fileName, path, sizeof(path)));
+    }
+    if (!session.source && !session.file)
+    {
+        debug(DebugByte::HUBLINK_FILE_OPEN_ERROR);
+        Serial.printf("Failed to use file: %s\n", fileName);
+        if (!sendIndication(session, pFileTransferCharacteristic, (uint8_t *)"NFF", 3))
+        {
+            Serial.println("Failed to send NFF (no file found) indication");
+        }
+        return;
+    }
+
+    // SD reads happen in sector-aligned bursts; BLE chunks are sliced out of the buffer.
+    // One gateway at a time gets the shared read-ahead buffer, others a smaller private one.
+    session.buffer = nullptr;
+    session.ownsBuffer = false;
+    if (!readAheadInUse && (session.buffer = acquireReadAheadBuffer()) != nullptr)
+    {
+        readAheadInUse = true;
+        session.bufferSize = readAheadAllocated;
+    }
+    else if ((session.buffer = (uint8_t *)heap_caps_malloc(READ_AHEAD_MIN, MALLOC_CAP_8BIT)) != nullptr)
+    {
+        session.ownsBuffer = true;
+        session.bufferSize = READ_AHEAD_MIN;
+    }
+    else
+    {
+        session.buffer = session.fallback;
+        session.bufferSize = sizeof(session.fallback);
+    }
+
+    // Digest the file as it streams so a later commitFile does not need to re-read it
+    mbedtls_sha256_init(&session.sha);
+    mbedtls_sha256_starts(&session.sha, 0);
+    session.fileName = fileName; // reuses the session's buffer
+    session.filled = 0;
+    session.offset = 0;
+    session.totalSent = 0;
+
+    // Read no further than the length at open (or, for a live file, the length listed), so a
+    // concurrent writer cannot stretch the transfer or hand out a half-written tail
+    session.remaining = session.source ? session.sourceLength : session.file.size();
+    for (const ManifestEntry &snapshot : liveSnapshots)
+    {
+        if (snapshot.name == session.fileName)
+        {
+            session.remaining = std::min(session.remaining, snapshot.size);
+        }
+    }
+
+    // The first burst may already be in the buffer from the advertising window
+    if (session.buffer == readAheadBuffer && !session.source)
+    {
+        if (prefetchLength > 0 && session.fileName == prefetchName &&
+            session.file.size() == prefetchFileSize && session.file.seek(prefetchLength))
+        {
+            session.filled = std::min(prefetchLength, session.remaining);
+            session.remaining -= session.filled;
+            mbedtls_sha256_update(&session.sha, session.buffer, session.filled);
+        }
+        prefetchName = "";
+        prefetchLength = 0;
+    }
+
+    session.transferring = true;
+    session.watchdogTimer = millis();
+    cpuBoost(); // SHA-256 and SD reads for the whole transfer; released by endTransfer()
+    session.boosted = true;
+}
+
+// Send one chunk; doBLE() calls this for every transferring session in turn
+void Hublink::pumpTransfer(Session &session)
+{
+    PhaseScope phase(*this, SyncPhase::TRANSFER);
+    session.watchdogTimer = millis();
+    if (session.offset == session.filled)
+    {
+        if (session.remaining == 0)
+        {
+            endTransfer(session, true); // EOF
+            return;
+        }
+        int bytesRead;
+        if (session.source)
+        {
+            bytesRead = std::min(session.bufferSize, session.remaining);
+            memcpy(session.buffer, session.source + session.sourceLength - session.remaining, bytesRead);
+        }
+        else
+        {
+            PhaseScope io(*this, SyncPhase::SD_IO);
+            bytesRead = session.file.read(session.buffer, std::min(session.bufferSize, session.remaining));
+        }
+        if (bytesRead <= 0)
+        {
+            Serial.println("Error reading from file.");
+            markSDError();
+            endTransfer(session, false);
+            return;
+        }
+        session.filled = bytesRead;
+        session.offset = 0;
+        session.remaining -= bytesRead;
+        mbedtls_sha256_update(&session.sha, session.buffer, bytesRead);
+    }
+
+    size_t chunk = std::min((size_t)session.mtuSize, session.filled - session.offset);
+    if (!sendIndication(session, pFileTransferCharacteristic, session.buffer + session.offset, chunk))
+    {
+        Serial.println("Failed to send file chunk indication");
+        endTransfer(session, false);
+        return;
+    }
+    session.offset += chunk;
+    session.totalSent += chunk;
+}
+
+void Hublink::endTransfer(Session &session, bool complete)
+{
+    if (!session.transferring)
+    {
+        return;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&session.sha, digest);
+    mbedtls_sha256_free(&session.sha);
+    if (accountingTask == xTaskGetCurrentTaskHandle())
+    {
+        lastSyncStats.bytesSent += session.totalSent;
+        lastSyncStats.mtu = std::max(lastSyncStats.mtu, session.mtuSize);
+    }
+    if (complete)
+    {
+        lastTransferName = session.fileName;
+        lastTransferSize = session.totalSent;
+        lastTransferDigest = digestToHex(digest);
+        lastTransferTraceEnd = session.source ? session.traceEnd : 0;
+    }
+    if (session.state == SESSION_ACTIVE &&
+        !sendIndication(session, pFileTransferCharacteristic, (uint8_t *)"EOF", 3))
+    {
+        Serial.println("Failed to send EOF indication");
+    }
+    Serial.printf("File transfer %s: %s\n", complete ? "complete" : "ended", session.fileName.c_str());
+    recordMemStats(MemPhase::TRANSFER);
+
+    debugValue(DebugByte::HUBLINK_FILE_CLOSE, session.totalSent);
+    if (!session.source)
+    {
+        session.file.close();
+    }
+    session.source = nullptr;
+    if (session.buffer == readAheadBuffer)
+    {
+        readAheadInUse = false;
+    }
+    else if (session.ownsBuffer)
+    {
+        heap_caps_free(session.buffer);
+    }
+    session.buffer = nullptr;
+    session.ownsBuffer = false;
+    session.fileName = "";
+    session.transferring = false;
+    if (session.boosted)
+    {
+        session.boosted = false;
+        cpuRelax(); // back to idle clock as soon as the transfer is done
+    }
+}
+
+String Hublink::digestToHex(const uint8_t *digest)
+{
+    static const char hex[] = "0123456789abcdef";
+    char out[65];
+    for (int i = 0; i < 32; i++)
+    {
+        out[i * 2] = hex[digest[i] >> 4];
+        out[i * 2 + 1] = hex[digest[i] & 0x0F];
+    }
+    out[64] = '\0';
+    return String(out);
+}
+
+String Hublink::computeFileDigest(const char *path, size_t *size)
+{
+    CpuBoostScope boost(*this); // hashing
+    File file = files().open(path, FILE_READ);
+    if (!file)
+    {
+        return "";
+    }
+
+    // The shared buffer may belong to another gateway's transfer
+    uint8_t *buffer = readAheadInUse ? nullptr : acquireReadAheadBuffer();
+    size_t bufferSize = readAheadAllocated;
+    if (buffer)
+    {
+        prefetchName = ""; // buffer contents are about to be replaced
+        prefetchLength = 0;
+    }
+    uint8_t fallback[SD_SECTOR_SIZE];
+    if (!buffer)
+    {
+        buffer = fallback;
+        bufferSize = sizeof(fallback);
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts(&sha, 0);
+    size_t total = 0;
+    int bytesRead;
+    while ((bytesRead = file.read(buffer, bufferSize)) > 0)
+    {
+        watchdogTimer = millis();
+        mbedtls_sha256_update(&sha, buffer, bytesRead);
+        total += bytesRead;
+    }
+    file.close();
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&sha, digest);
+    mbedtls_sha256_free(&sha);
+    *size = total;
+    return digestToHex(digest);
+}
+
+// Gateway confirmed fileName is stored. Verified against the digest (or, without one, against the
+// last complete transfer of this session) before the commit policy is applied.
+bool Hublink::commitFile(const char *fileName, const char *digest)
+{
+    PhaseScope phase(*this, SyncPhase::SD_IO);
+    char path[MAX_FILE_PATH];
+    resolveFilePath(fileName, path, sizeof(path));
+    bool ok = false;
+
+    if (isTraceFile(fileName))
+    {
+        // Stored events are not offered again; the file has no copy on the card to archive or delete
+        // Only what was actually delivered is marked stored, whatever has been listed since
+        bool transferred = lastTransferName == fileName && lastTransferSize > 0 && lastTransferTraceEnd > 0;
+        ok = transferred && !isFileInTransfer(fileName) &&
+             (digest[0] == '\0' || strcasecmp(digest, lastTransferDigest.c_str()) == 0);
+        if (ok)
+        {
+            if (lastTransferTraceEnd > trace.getCommitted())
+            {
+                trace.setCommitted(lastTransferTraceEnd);
+            }
+            lastTransferTraceEnd = 0;
+            traceFileLength = 0;
+            invalidateListing();
+        }
+        else
+        {
+            Serial.printf("Commit rejected, content not verified: %s\n", fileName);
+        }
+    }
+    else if (commit_policy == CommitPolicy::NONE)
+    {
+        Serial.println("Commit ignored: commit_policy is none");
+    }
+    else if (!isValidFile(fileName) || strchr(fileName, '/') != nullptr || !files().exists(path))
+    {
+        Serial.printf("Commit rejected, no such file: %s\n", fileName);
+    }
+    else if (isFileLive(fileName) || isFileWriterOpen(fileName))
+    {
+        Serial.printf("Commit rejected, file is still being written: %s\n", fileName);
+    }
+    else if (isFileInTransfer(fileName))
+    {
+        Serial.printf("Commit rejected, file is being sent to another gateway: %s\n", fileName);
+    }
+    else
+    {
+        File file = files().open(path, FILE_READ);
+        size_t size = file ? file.size() : 0;
+        if (file)
+        {
+            file.close();
+        }
+
+        // Reuse the digest from the transfer if the file has not changed since
+        String actual;
+        if (lastTransferName == fileName && size == lastTransferSize)
+        {
+            actual = lastTransferDigest;
+        }
+        else if (digest[0] != '\0')
+        {
+            actual = computeFileDigest(path, &size);
+        }
+
+        if (actual.isEmpty() || (digest[0] != '\0' && strcasecmp(digest, actual.c_str()) != 0))
+        {
+            Serial.printf("Commit rejected, content not verified: %s\n", fileName);
+        }
+        else if (commit_policy == CommitPolicy::ARCHIVE)
+        {
+            char archivePath[MAX_FILE_PATH];
+            snprintf(archivePath, sizeof(archivePath), ARCHIVE_DIR "/%s", fileName);
+            if (!files().exists(ARCHIVE_DIR))
+            {
+                files().mkdir(ARCHIVE_DIR);
+            }
+            if (files().exists(archivePath))
+            {
+                files().remove(archivePath); // live file is a superset of the archived copy
+            }
+            ok = files().rename(path, archivePath);
+        }
+        else if (commit_policy == CommitPolicy::DELETE)
+        {
+            ok = files().remove(path);
+        }
+        else if (commit_policy == CommitPolicy::MANIFEST)
+        {
+            loadManifest();
+            File manifestFile = files().open(MANIFEST_PATH, FILE_APPEND);
+            if (manifestFile)
+            {
+                ok = manifestFile.printf("%s|%u|%s\n", fileName, (unsigned)size, actual.c_str()) > 0;
+                manifestFile.close();
+            }
+            if (ok)
+            {
+                manifest.push_back({fileName, size});
+            }
+        }
+
+        if (!ok && !actual.isEmpty())
+        {
+            markSDError();
+        }
+        else if (ok && commit_policy != CommitPolicy::MANIFEST)
+        {
+            removeFromShardIndex(fileName);
+        }
+        if (ok)
+        {
+            invalidateListing();
+        }
+    }
+
+    debug(ok ? DebugByte::HUBLINK_TRANSFER_COMMIT : DebugByte::HUBLINK_TRANSFER_COMMIT_FAIL);
+    Serial.printf("Commit %s: %s\n", ok ? "done" : "failed", fileName);
+    return ok;
+}
+
+String Hublink::currentShardName()
+{
+    char name[16];
+    if (shard_mode == ShardMode::DAY)
+    {
+        time_t now = time(nullptr);
+        struct tm utc;
+        gmtime_r(&now, &utc);
+        if (utc.tm_year + 1900 < 2020)
+        {
+            return "undated"; // clock not set yet (see setTimestampCallback)
+        }
+        snprintf(name, sizeof(name), "%04d%02d%02d", utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday);
+        return String(name);
+    }
+
+    // COUNT: newest shard until it holds shard_size files
+    uint16_t newest = shardDirs.empty() ? 0 : (uint16_t)(shardDirs.size() - 1);
+    uint32_t number = 1;
+    size_t inNewest = 0;
+    if (!shardDirs.empty())
+    {
+        number = strtoul(shardDirs[newest].c_str(), nullptr, 10);
+        for (const ShardFile &file : shardFiles)
+        {
+            inNewest += file.shard == newest;
+        }
+        for (const PendingShardFile &file : pendingShardFiles)
+        {
+            inNewest += file.shard == shardDirs[newest];
+        }
+        if (inNewest >= shard_size)
+        {
+            number++;
+        }
+    }
+    snprintf(name, sizeof(name), "%06lu", (unsigned long)number);
+    return String(name);
+}
+
+// The file joins the shard index once it exists on the card (see indexPendingShardFiles)
+String Hublink::getDataFilePath(const String &fileName)
+{
+    MutexGuard guard(storageMutex);
+    if (shard_mode == ShardMode::NONE)
+    {
+        return "/" + fileName;
+    }
+
+    loadShardIndex();
+    int existing = findShardFile(fileName.c_str());
+    if (existing >= 0)
+    {
+        shardFiles[existing].written = true;
+        return String(DATA_DIR) + "/" + shardDirs[shardFiles[existing].shard] + "/" + fileName;
+    }
+    int pending = findPendingShardFile(fileName.c_str());
+    if (pending >= 0)
+    {
+        return String(DATA_DIR) + "/" + pendingShardFiles[pending].shard + "/" + fileName;
+    }
+
+    String shard = currentShardName();
+    bool known = false;
+    for (const String &dir : shardDirs)
+    {
+        if (dir == shard)
+        {
+            known = true;
+            break;
+        }
+    }
+
+    String dir = String(DATA_DIR) + "/" + shard;
+    if (!known)
+    {
+        if (!files().exists(DATA_DIR))
+        {
+            files().mkdir(DATA_DIR);
+        }
+        files().mkdir(dir);
+        shardDirs.push_back(shard);
+    }
+    pendingShardFiles.push_back({fileName, shard});
+    return dir + "/" + fileName;
+}
+
+void Hublink::loadShardIndex()
+{
+    if (shardIndexLoaded)
+    {
+        return;
+    }
+    shardIndexLoaded = true;
+    shardDirs.clear();
+    shardFiles.clear();
+
+    File dataDir = files().open(DATA_DIR);
+    if (!dataDir || !dataDir.isDirectory())
+    {
+        return;
+    }
+
+    File shard;
+    while ((shard = dataDir.openNextFile()))
+    {
+        if (!shard.isDirectory())
+        {
+            shard.close();
+            continue;
+        }
+
+        // Shard names sort chronologically (YYYYMMDD or zero-padded count)
+        String shardName = shard.name();
+        size_t position = shardDirs.size();
+        while (position > 0 && shardDirs[position - 1].compareTo(shardName) > 0)
+        {
+            position--;
+        }
+        for (ShardFile &file : shardFiles)
+        {
+            if (file.shard >= position)
+            {
+                file.shard++;
+            }
+        }
+        shardDirs.insert(shardDirs.begin() + position, shardName);
+
+        File entry;
+        while ((entry = shard.openNextFile()))
+        {
+            if (!entry.isDirectory())
+            {
+                shardFiles.push_back({String(entry.name()), (uint16_t)position, entry.size(), false});
+            }
+            entry.close();
+        }
+        shard.close();
+    }
+    dataDir.close();
+    Serial.printf("Shard index: %u files in %u shards\n", (unsigned)shardFiles.size(), (unsigned)shardDirs.size());
+}
+
+// Move pending names whose file now exists into the index; a pending name is usually the one
+// file being written, so this costs at most a few opens per listing
+void Hublink::indexPendingShardFiles()
+{
+    for (size_t i = 0; i < pendingShardFiles.size();)
+    {
+        const PendingShardFile &pending = pendingShardFiles[i];
+        int indexed = findShardFile(pending.name.c_str());
+        if (indexed >= 0)
+        {
+            shardFiles[indexed].written = true; // picked up by an index reload
+            pendingShardFiles.erase(pendingShardFiles.begin() + i);
+            continue;
+        }
+
+        char path[MAX_FILE_PATH];
+        snprintf(path, sizeof(path), DATA_DIR "/%s/%s", pending.shard.c_str(), pending.name.c_str());
+        File entry = files().open(path);
+        if (!entry)
+        {
+            i++;
+            continue;
+        }
+        size_t size = entry.size();
+        entry.close();
+
+        for (size_t shard = 0; shard < shardDirs.size(); shard++)
+        {
+            if (shardDirs[shard] == pending.shard)
+            {
+                shardFiles.push_back({pending.name, (uint16_t)shard, size, true});
+                break;
+            }
+        }
+        pendingShardFiles.erase(pendingShardFiles.begin() + i);
+    }
+}
+
+int Hublink::findPendingShardFile(const char *fileName)
+{
+    for (size_t i = 0; i < pendingShardFiles.size(); i++)
+    {
+        if (pendingShardFiles[i].name == fileName)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int Hublink::findShardFile(const char *fileName)
+{
+    for (size_t i = 0; i < shardFiles.size(); i++)
+    {
+        if (shardFiles[i].name == fileName)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Sharded files resolve through the index; anything else is looked up in the root as before
+// Path of a listed file, written into path (empty if it does not fit). @return path
+const char *Hublink::resolveFilePath(const char *fileName, char *path, size_t pathSize)
+{
+    MutexGuard guard(storageMutex);
+    loadShardIndex();
+    indexPendingShardFiles();
+    int index = findShardFile(fileName);
+    int length = index >= 0
+                     ? snprintf(path, pathSize, DATA_DIR "/%s/%s", shardDirs[shardFiles[index].shard].c_str(), fileName)
+                     : snprintf(path, pathSize, "/%s", fileName);
+    if (length < 0 || (size_t)length >= pathSize)
+    {
+        path[0] = '\0';
+    }
+    return path;
+}
+
+// Drop a committed file; an emptied shard directory is removed so scans stay small
+void Hublink::removeFromShardIndex(const char *fileName)
+{
+    MutexGuard guard(storageMutex);
+    int index = findShardFile(fileName);
+    if (index < 0)
+    {
+        return;
+    }
+    uint16_t shard = shardFiles[index].shard;
+    shardFiles.erase(shardFiles.begin() + index);
+
+    for (const ShardFile &file : shardFiles)
+    {
+        if (file.shard == shard)
+        {
+            return;
+        }
+    }
+    for (const PendingShardFile &file : pendingShardFiles)
+    {
+        if (file.shard == shardDirs[shard])
+        {
+            return; // a writer is about to create a file there
+        }
+    }
+    // Keep the newest shard; it is still being filled
+    if (shard + 1 < shardDirs.size())
+    {
+        files().rmdir(String(String(DATA_DIR) + "/" + shardDirs[shard]).c_str());
+        shardDirs.erase(shardDirs.begin() + shard);
+        for (ShardFile &file : shardFiles)
+        {
+            if (file.shard > shard)
+            {
+                file.shard--;
+            }
+        }
+    }
+}
+
+void Hublink::appendShardListing(String &fileInfo)
+{
+    MutexGuard guard(storageMutex);
+    loadShardIndex();
+    indexPendingShardFiles();
+    for (ShardFile &file : shardFiles)
+    {
+        watchdogTimer = millis();
+        if (!isValidFile(file.name))
+        {
+            continue;
+        }
+        if (file.written || isFileWriterOpen(file.name.c_str()) || isFileLive(file.name.c_str()))
+        {
+            // May still be growing; everything else keeps the size from the index scan
+            char path[MAX_FILE_PATH];
+            snprintf(path, sizeof(path), DATA_DIR "/%s/%s", shardDirs[file.shard].c_str(), file.name.c_str());
+            File entry = files().open(path);
+            if (!entry)
+            {
+                continue;
+            }
+            file.size = entry.size();
+            entry.close();
+        }
+        appendListingEntry(fileInfo, file.name.c_str(), file.size);
+    }
+}
+
+// "HLTR", version 1, record size, record count (uint16), then the records oldest first
+void Hublink::appendTraceListing(String &fileInfo)
+{
+    if (!offer_trace_file || isFileInTransfer(TRACE_FILE_NAME))
+    {
+        return; // keep the snapshot another gateway is reading
+    }
+    HublinkTraceEvent *events = (HublinkTraceEvent *)(traceFile + TRACE_FILE_HEADER);
+    size_t count = trace.copySince(trace.getCommitted(), events, HUBLINK_TRACE_EVENTS_KEPT, &traceFileEnd);
+    if (count == 0)
+    {
+        traceFileLength = 0;
+        return;
+    }
+    memcpy(traceFile, "HLTR", 4);
+    traceFile[4] = 1;
+    traceFile[5] = sizeof(HublinkTraceEvent);
+    traceFile[6] = count & 0xFF;
+    traceFile[7] = count >> 8;
+    traceFileLength = TRACE_FILE_HEADER + count * sizeof(HublinkTraceEvent);
+
+    if (!fileInfo.isEmpty())
+    {
+        fileInfo += ";";
+    }
+    fileInfo += TRACE_FILE_NAME;
+    fileInfo += '|';
+    fileInfo += (unsigned long)traceFileLength;
+}
+
+// Listing rules shared by the root and shard scans
+void Hublink::appendListingEntry(String &fileInfo, const char *fileName, size_t size)
+{
+    if (!isValidFile(fileName) || isCommittedInManifest(fileName, size))
+    {
+        return;
+    }
+    if (isFileLive(fileName))
+    {
+        if (!offer_live_files)
+        {
+            return; // still being written; offered once sealed
+        }
+        liveSnapshots.push_back({String(fileName), size}); // transfer stops at the listed length
+    }
+    if (!fileInfo.isEmpty())
+    {
+        fileInfo += ";";
+    }
+    fileInfo += fileName; // appended in place: no temporaries, and the listing keeps its capacity
+    fileInfo += '|';
+    fileInfo += (unsigned long)size;
+}
+
+static void setFileMember(std::vector<String> &set, const String &fileName, bool member)
+{
+    for (size_t i = 0; i < set.size(); i++)
+    {
+        if (set[i] == fileName)
+        {
+            if (!member)
+            {
+                set.erase(set.begin() + i);
+            }
+            return;
+        }
+    }
+    if (member)
+    {
+        set.push_back(fileName);
+    }
+}
+
+static bool isFileMember(const std::vector<String> &set, const char *fileName)
+{
+    for (const String &member : set)
+    {
+        if (member == fileName)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Hublink::setFileLive(const String &fileName, bool live)
+{
+    MutexGuard guard(stateMutex);
+    setFileMember(liveFiles, fileName, live);
+}
+
+bool Hublink::isFileLive(const String &fileName)
+{
+    return isFileLive(fileName.c_str());
+}
+
+bool Hublink::isFileLive(const char *fileName)
+{
+    MutexGuard guard(stateMutex);
+    return isFileMember(liveFiles, fileName);
+}
+
+void Hublink::setFileWriterOpen(const String &fileName, bool open)
+{
+    MutexGuard guard(stateMutex);
+    setFileMember(writerOpenFiles, fileName, open);
+}
+
+bool Hublink::isFileWriterOpen(const String &fileName)
+{
+    return isFileWriterOpen(fileName.c_str());
+}
+
+bool Hublink::isFileWriterOpen(const char *fileName)
+{
+    MutexGuard guard(stateMutex);
+    return isFileMember(writerOpenFiles, fileName);
+}
+
+bool Hublink::dataFileExists(const String &fileName)
+{
+    MutexGuard guard(storageMutex);
+    loadShardIndex();
+    indexPendingShardFiles();
+    char path[MAX_FILE_PATH];
+    snprintf(path, sizeof(path), "/%s", fileName.c_str());
+    return findShardFile(fileName.c_str()) >= 0 || files().exists(path);
+}
+
+void Hublink::loadManifest()
+{
+    if (manifestLoaded)
+    {
+        return;
+    }
+    manifestLoaded = true;
+    manifest.clear();
+
+    File manifestFile = files().open(MANIFEST_PATH, FILE_READ);
+    if (!manifestFile)
+    {
+        return;
+    }
+    while (manifestFile.available())
+    {
+        String line = manifestFile.readStringUntil('\n');
+        int first = line.indexOf('|');
+        int second = line.indexOf('|', first + 1);
+        if (first > 0 && second > first)
+        {
+            manifest.push_back({line.substring(0, first), (size_t)line.substring(first + 1, second).toInt()});
+        }
+    }
+    manifestFile.close();
+}
+
+// A committed file reappears in listings as soon as it grows (size is the diff proxy)
+bool Hublink::isCommittedInManifest(const char *fileName, size_t size)
+{
+    loadManifest();
+    for (const ManifestEntry &entry : manifest)
+    {
+        if (entry.size == size && entry.name == fileName)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Hublink::setReadAheadSize(size_t bytes)
+{
+    bytes = std::max(READ_AHEAD_MIN, std::min(READ_AHEAD_MAX, bytes));
+    bytes -= bytes % SD_SECTOR_SIZE; // whole sectors
+    if (bytes != readAheadSize)
+    {
+        releaseReadAheadBuffer();
+        readAheadSize = bytes;
+    }
+}
+
+// Allocated on first transfer and kept; PSRAM is preferred so internal heap stays free for BLE
+void Hublink::setArenaSize(size_t bytes)
+{
+    if (bytes != arenaSize)
+    {
+        arena.end(); // reallocated at the next sync
+        arenaSize = bytes;
+    }
+}
+
+uint8_t *Hublink::acquireReadAheadBuffer()
+{
+    if (readAheadBuffer != nullptr)
+    {
+        return readAheadBuffer;
+    }
+
+    for (size_t size = readAheadSize; size >= READ_AHEAD_MIN; size /= 2)
+    {
+        if (psramFound())
+        {
+            readAheadBuffer = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        }
+        if (readAheadBuffer == nullptr)
+        {
+            readAheadBuffer = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        }
+        if (readAheadBuffer != nullptr)
+        {
+            readAheadAllocated = size;
+            return readAheadBuffer;
+        }
+    }
+
+    Serial.println("Warning: read-ahead buffer allocation failed, using MTU-sized reads");
+    return nullptr;
+}
+
+void Hublink::releaseReadAheadBuffer()
+{
+    if (readAheadBuffer != nullptr)
+    {
+        heap_caps_free(readAheadBuffer);
+        readAheadBuffer = nullptr;
+    }
+    readAheadAllocated = 0;
+    prefetchName = "";
+    prefetchLength = 0;
+}
+
+bool Hublink::isValidFile(const String &fileName)
+{
+    return isValidFile(fileName.c_str());
+}
+
+bool Hublink::isValidFile(const char *fileName)
+{
+    // Exclude files that start with a dot
+    if (fileName[0] == '.')
+    {
+        return false;
+    }
+
+    // Check for valid extensions, ignoring case
+    size_t length = strlen(fileName);
+    MutexGuard guard(stateMutex); // the sketch may change the list during syncAsync()
+    for (const auto &ext : validExtensions)
+    {
+        if (ext.length() <= length && strcasecmp(fileName + length - ext.length(), ext.c_str()) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Hublink::onConnect(uint16_t connHandle)
 {
     if (!pServer)
     {
         Serial.println("Warning: Connect callback with null server");
         return;
     }
-    Serial.println("Hublink node connected.");
+
+    Session *session = nullptr;
+    for (Session &candidate : sessions)
+    {
+        if (candidate.state == SESSION_FREE)
+        {
+            session = &candidate;
+            break;
+        }
+    }
+    if (!session)
+    {
+        Serial.printf("Gateway %u rejected: all %d sessions in use\n", connHandle, HUBLINK_MAX_SESSIONS);
+        pServer->disconnect(connHandle);
+        return;
+    }
+
+    debugValue(DebugByte::HUBLINK_BLE_CONNECT, connHandle);
+    Serial.printf("Hublink node connected (gateway %u).\n", connHandle);
+    session->connHandle = connHandle;
+    session->mtuSize = 20;
+    session->watchdogTimer = millis();
+    session->state = SESSION_ACTIVE;
     deviceConnected = true;
     didConnect = true;
     watchdogTimer = millis();
 
-    // Get the connection handle from the first connected client
-    uint16_t connHandle = pServer->getPeerInfo(0).getConnHandle();
-
     // Now we can properly update connection parameters in correct order:
     // connHandle, minInterval, maxInterval, latency, timeout
     pServer->updateConnParams(connHandle, 12, 16, 0, 100);
     NimBLEDevice::setMTU(NEGOTIATE_MTU_SIZE);
+    recordMemStats(MemPhase::CONNECT);
+
+    // NimBLE stops advertising on connect; keep advertising while another gateway can join
+    if (getActiveSessionCount() < HUBLINK_MAX_SESSIONS)
+    {
+        NimBLEDevice::getAdvertising()->start();
+    }
 }
 
-void Hublink::onDisconnect()
+void Hublink::onDisconnect(uint16_t connHandle)
 {
     if (!pServer)
     {
         Serial.println("Warning: Disconnect callback with null server");
         return;
     }
-    Serial.println("Hublink node disconnected.");
-    deviceConnected = false;
+    debugValue(DebugByte::HUBLINK_BLE_DISCONNECT, connHandle);
+    Session *session = findSession(connHandle);
+    if (session)
+    {
+        session->state = SESSION_CLOSING; // doBLE() closes its file and frees the slot
+    }
+    deviceConnected = getActiveSessionCount() > 0;
+    Serial.printf("Hublink node disconnected (gateway %u).\n", connHandle);
+}
+
+uint8_t Hublink::getActiveSessionCount() const
+{
+    uint8_t count = 0;
+    for (const Session &session : sessions)
+    {
+        count += session.state == SESSION_ACTIVE;
+    }
+    return count;
+}
+
+Hublink::Session *Hublink::findSession(uint16_t connHandle)
+{
+    for (Session &session : sessions)
+    {
+        if (session.state == SESSION_ACTIVE && session.connHandle == connHandle)
+        {
+            return &session;
+        }
+    }
+    return nullptr;
+}
+
+bool Hublink::isFileInTransfer(const char *fileName)
+{
+    for (const Session &session : sessions)
+    {
+        if (session.transferring && session.fileName == fileName)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Hublink::isMetaUploadInProgress() const
+{
+    for (const Session &session : sessions)
+    {
+        if (session.meta.inProgress)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Hublink::closeSession(Session &session)
+{
+    if (session.meta.inProgress)
+    {
+        cleanupMetaJsonTransfer(session); // gateway went away mid-upload
+    }
+    endTransfer(session, false);
+    session.listing = false;
+    session.listingOffset = 0;
+    session.listingSent = false;
+    if (session.boosted)
+    {
+        session.boosted = false; // held by an unfinished listing
+        cpuRelax();
+    }
+    session.commands.clear();
+    session.meta.dropped = false;
+    session.connHandle = BLE_HS_CONN_HANDLE_NONE;
+    session.state = SESSION_FREE;
+    if (listingStale)
+    {
+        invalidateListing(); // this gateway was the one still reading the old listing
+    }
+}
+
+void Hublink::closeAllSessions()
+{
+    for (Session &session : sessions)
+    {
+        closeSession(session);
+    }
+}
+
+// Watchdog, queued requests and one transfer chunk for every connected gateway, round-robin.
+// @return true while any transfer is in progress
+bool Hublink::serviceSessions()
+{
+    bool transferring = false;
+    for (Session &session : sessions)
+    {
+        uint8_t state = session.state;
+        if (state == SESSION_CLOSING)
+        {
+            closeSession(session);
+            continue;
+        }
+        if (state != SESSION_ACTIVE)
+        {
+            continue;
+        }
+
+        // Long SD work done for another gateway (listing, digest) counts as progress
+        unsigned long now = millis();
+        if (std::min(now - session.watchdogTimer, now - watchdogTimer) > watchdogTimeoutMs)
+        {
+            debugValue(DebugByte::HUBLINK_TRANSFER_TIMEOUT, session.connHandle);
+            Serial.printf("Gateway %u timeout detected, disconnecting...\n", session.connHandle);
+
+            // Cleanup any in-progress transfers first
+            if (session.meta.inProgress)
+            {
+                debug(DebugByte::HUBLINK_CLEANUP_START);
+                cleanupMetaJsonTransfer(session);
+                debug(DebugByte::HUBLINK_CLEANUP_COMPLETE);
+            }
+            endTransfer(session, false);
+            pServer->disconnect(session.connHandle);
+            session.watchdogTimer = now; // until the disconnect callback arrives
+            continue;
+        }
+
+        // A gateway's requests run in order; the next starts once its transfer or listing is done
+        HublinkCommandQueue<COMMAND_QUEUE_DEPTH, COMMAND_MAX_PAYLOAD>::Command *command;
+        while (!session.transferring && !session.listing && session.state == SESSION_ACTIVE &&
+               (command = session.commands.front()) != nullptr)
+        {
+            session.watchdogTimer = millis();
+            if (command->type == COMMAND_FILENAME)
+            {
+                startTransfer(session, command->data);
+            }
+            else if (command->type == COMMAND_META_UPLOAD)
+            {
+                handleMetaUploadPacket(session, (const uint8_t *)command->data, command->length);
+            }
+            else
+            {
+                handleGatewayCommand(session, command->data, command->length);
+            }
+            session.commands.pop(); // slot may be reused only after the handler is done with it
+        }
+
+        if (session.transferring)
+        {
+            pumpTransfer(session);
+        }
+        else if (session.listing)
+        {
+            pumpListing(session);
+        }
+        transferring |= session.transferring || session.listing;
+
+        // An upload (binary or chunked) abandoned by its gateway must not hold the temp file forever
+        if (session.meta.inProgress && millis() - session.meta.lastChunkTime > META_JSON_TIMEOUT_MS)
+        {
+            Serial.printf("Meta.json transfer timed out (gateway %u)\n", session.connHandle);
+            if (session.meta.binary)
+            {
+                notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, session.meta.received);
+            }
+            cleanupMetaJsonTransfer(session);
+        }
+
+        // Go-back-N: a packet lost to a full queue is resent once the gateway sees where we are
+        if (session.meta.dropped.exchange(false) && session.meta.inProgress && session.meta.binary)
+        {
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ACK, session.meta.received);
+        }
+    }
+    return transferring;
 }
 
 void Hublink::resetBLEState()
@@ -697,9 +2298,6 @@ void Hublink::resetBLEState()
     // BLE state
     deviceConnected = false;
     piReadyForFilenames = false;
-    currentFileName = "";
-    allFilesSent = false;
-    sendFilenames = false;
     watchdogTimer = 0;
     didConnect = false;
 
@@ -708,98 +2306,163 @@ void Hublink::resetBLEState()
     // Reset battery level to default
     batteryLevel = 0;
 
-    // Meta.json state
-    if (metaJsonTransferInProgress)
-    {
-        cleanupMetaJsonTransfer();
-    }
-
-    // File handles
+    // File handles; closing the sessions also drops their meta.json uploads
     if (rootFileOpen)
     {
         rootFile.close();
         rootFileOpen = false;
     }
-    if (transferFileOpen)
-    {
-        transferFile.close();
-        transferFileOpen = false;
-    }
-    if (tempMetaJsonFile)
-    {
-        tempMetaJsonFile.close();
-    }
-
-    // Clear meta.json state
-    if (metaJsonTransferInProgress)
-    {
-        cleanupMetaJsonTransfer();
-    }
+    closeAllSessions();
 
     // Clear the dynamic document
+    MutexGuard guard(metaMutex);
     metaDoc.clear();
     metaDocValid = false;
 }
 
-void Hublink::updateMtuSize()
+void Hublink::updateMtuSize(Session &session)
 {
-    mtuSize = NimBLEDevice::getMTU() - MTU_HEADER_SIZE;
-    Serial.printf("Updated MTU size: %d\n", mtuSize);
+    // Negotiated per connection
+    uint16_t mtu = pServer ? pServer->getPeerMTU(session.connHandle) : NimBLEDevice::getMTU();
+    if (mtu <= MTU_HEADER_SIZE)
+    {
+        mtu = 23; // BLE default ATT MTU
+    }
+    session.mtuSize = mtu - MTU_HEADER_SIZE;
+    HUBLINK_LOGV("Updated MTU size (gateway %u): %d\n", session.connHandle, session.mtuSize);
 }
 
-String Hublink::parseGateway(NimBLECharacteristic *pCharacteristic, const String &key)
+// NimBLE host task: copy the write into the gateway's queue and return; doBLE() handles it
+void Hublink::enqueueCommand(uint8_t type, uint16_t connHandle, const uint8_t *data, size_t length)
 {
-    static DynamicJsonDocument doc(1024); // Reuse document
-    doc.clear();                          // Clear previous contents
-
-    if (!pCharacteristic)
+    Session *session = findSession(connHandle);
+    if (!session || !session->commands.push(type, (const char *)data, length))
     {
-        Serial.println("Warning: Null characteristic in parseGateway");
-        return "";
+        if (session && type == COMMAND_META_UPLOAD)
+        {
+            session->meta.dropped = true;
+        }
+        droppedCommands++;
+        debugValue(DebugByte::HUBLINK_BLE_COMMAND_DROPPED, length); // counted; a flood must not stall the host task on UART
+        HUBLINK_LOGV("Command dropped (gateway %u, %u bytes)\n", connHandle, (unsigned)length);
     }
+}
 
-    std::string rawValue = pCharacteristic->getValue();
-    if (rawValue.empty())
+// Gateway values may be strings, numbers or booleans; returns their text ("" if absent).
+// Strings point into the document, numbers are formatted into scratch.
+static const char *gatewayValue(JsonVariantConst value, char *scratch, size_t scratchSize)
+{
+    if (value.isNull())
     {
-        Serial.println("Config: None");
         return "";
     }
+    if (value.is<bool>())
+    {
+        return value.as<bool>() ? "true" : "false";
+    }
+    if (value.is<long>())
+    {
+        snprintf(scratch, scratchSize, "%ld", value.as<long>());
+        return scratch;
+    }
+    const char *text = value.as<const char *>();
+    return text ? text : "";
+}
 
-    DeserializationError error = deserializeJson(doc, rawValue.c_str());
-
+void Hublink::handleGatewayCommand(Session &session, const char *json, size_t length)
+{
+    // metaJsonPatch can be large and is parsed separately, so keep it out of this document
+    static StaticJsonDocument<192> filter;
+    if (filter.isNull())
+    {
+        filter["timestamp"] = true;
+        filter["sendFilenames"] = true;
+        filter["watchdogTimeoutMs"] = true;
+        filter["commitFile"] = true;
+        filter["digest"] = true;
+        filter["metaJsonId"] = true;
+        filter["metaJsonData"] = true;
+        filter["memStats"] = true;
+    }
+    HublinkJsonDocument doc(1024); // from the sync arena
+
+    DeserializationError error = deserializeJson(doc, json, length, DeserializationOption::Filter(filter));
     if (error)
     {
         Serial.print("Config: JSON parsing failed: ");
         Serial.println(error.c_str());
-        return "";
+        return;
     }
+    HUBLINK_LOGV("Config: Parsing JSON: %s\n", json);
+
+    char scratch[24]; // numbers formatted as text
 
-    if (!doc.containsKey(key))
+    // Handle timestamp
+    const char *timestamp = gatewayValue(doc["timestamp"], scratch, sizeof(scratch));
+    if (timestamp[0] != '\0')
     {
-        return "";
+        handleTimestamp(timestamp);
+        HUBLINK_LOGV("Timestamp callback complete.\n");
     }
 
-    // Only print if parsing succeeded
-    Serial.println("Config: Parsing JSON: " + String(rawValue.c_str()));
+    // Handle watchdogTimeoutMs
+    const char *watchdogTimeout = gatewayValue(doc["watchdogTimeoutMs"], scratch, sizeof(scratch));
+    if (watchdogTimeout[0] != '\0')
+    {
+        watchdogTimeoutMs = atol(watchdogTimeout);
+        HUBLINK_LOGV("Watchdog timeout callback complete.\n");
+    }
 
-    // Always convert to string, handling all types
-    if (doc[key].is<bool>())
+    // Handle commitFile: gateway confirms a file is stored (optional sha256 "digest")
+    const char *commit = gatewayValue(doc["commitFile"], scratch, sizeof(scratch));
+    if (commit[0] != '\0')
     {
-        return doc[key].as<bool>() ? "true" : "false";
+        // Confirm on the filename characteristic: "ACK:<name>" or "NAK:<name>"
+        char reply[MAX_FILE_PATH];
+        bool ok = commitFile(commit, doc["digest"] | "");
+        int replyLength = snprintf(reply, sizeof(reply), "%s:%s", ok ? "ACK" : "NAK", commit);
+        sendIndication(session, pFilenameCharacteristic, (const uint8_t *)reply,
+                       std::min((size_t)replyLength, sizeof(reply) - 1));
     }
-    else if (doc[key].is<int>() || doc[key].is<long>())
+
+    // Handle meta.json merge patch (single write, no chunking)
+    if (strstr(json, "\"metaJsonPatch\"") != nullptr)
     {
-        return String(doc[key].as<long>());
+        applyMetaJsonPatch(json, length);
     }
-    else
+
+    // Handle meta.json transfer
+    const char *metaJsonId = gatewayValue(doc["metaJsonId"], scratch, sizeof(scratch));
+    const char *metaJsonData = doc["metaJsonData"] | "";
+    if (metaJsonId[0] != '\0' && metaJsonData[0] != '\0')
     {
-        return doc[key].as<String>();
+        handleMetaJsonChunk(session, atol(metaJsonId), metaJsonData);
+    }
+
+    // Memory readings for the gateway, same chunking as the listing
+    if (strcmp(gatewayValue(doc["memStats"], scratch, sizeof(scratch)), "true") == 0)
+    {
+        updateMtuSize(session);
+        sendMemStats(session);
+    }
+
+    // Listing goes last so it reflects a commit in the same write; serviceSessions() sends it
+    if (strcmp(gatewayValue(doc["sendFilenames"], scratch, sizeof(scratch)), "true") == 0)
+    {
+        debug(DebugByte::HUBLINK_FILE_LIST_START);
+        updateMtuSize(session);
+        HUBLINK_LOGV("MTU Size (negotiated): %d\nSending filenames...\n", session.mtuSize);
+        session.listing = true;
+        session.listingOffset = 0;
+        cpuBoost(); // staging and indications until the EOF; released by pumpListing()
+        session.boosted = true;
     }
 }
 
 void Hublink::sleep(uint64_t seconds)
 {
     uint64_t microseconds = seconds * 1000000ULL; // Convert seconds to microseconds
+    flushTrace();
     esp_sleep_enable_timer_wakeup(microseconds);
     esp_light_sleep_start();
     delay(10); // wakeup delay
@@ -818,138 +2481,55 @@ bool Hublink::doBLE()
         return false;
     }
 
+    // Files may have been written since the last sync
+    invalidateListing();
+    closeAllSessions(); // nothing carries over from a previous connection
+
     debug(DebugByte::HUBLINK_BLE_ADV_START);
     startAdvertising();
+    if (accountingTask == xTaskGetCurrentTaskHandle())
+    {
+        // Sampled while the stack is up: without persistentBLE, stopAdvertising() deinitializes NimBLE
+        lastSyncStats.cpuMhz = getCpuFrequencyMhz();
+        lastSyncStats.txPowerDbm = NimBLEDevice::getPower();
+    }
     unsigned long subLoopStartTime = millis();
 
     // update connection status
-    while ((millis() - subLoopStartTime < advertise_for * 1000 && !didConnect) || deviceConnected)
+    while ((millis() - subLoopStartTime < advertiseForSeconds() * 1000 && !didConnect) || deviceConnected)
     {
-        // Watchdog timer
-        if (deviceConnected && (millis() - watchdogTimer > watchdogTimeoutMs))
-        {
-            debug(DebugByte::HUBLINK_TRANSFER_TIMEOUT);
-            Serial.println("Hublink node timeout detected, disconnecting...");
-
-            // Cleanup any in-progress transfers first
-            if (metaJsonTransferInProgress)
-            {
-                debug(DebugByte::HUBLINK_CLEANUP_START);
-                cleanupMetaJsonTransfer();
-                debug(DebugByte::HUBLINK_CLEANUP_COMPLETE);
-            }
+        switchPhase(deviceConnected ? SyncPhase::CONNECTED_IDLE : SyncPhase::ADVERTISING);
 
-            // Close files before disconnecting
-            if (rootFileOpen)
-            {
-                debug(DebugByte::HUBLINK_FILE_CLOSE);
-                rootFile.close();
-                rootFileOpen = false;
-            }
-            if (transferFileOpen)
-            {
-                debug(DebugByte::HUBLINK_FILE_CLOSE);
-                transferFile.close();
-                transferFileOpen = false;
-            }
-
-            // Then handle disconnect
-            if (pServer->getConnectedCount() > 0)
-            {
-                NimBLEConnInfo connInfo = pServer->getPeerInfo(0);
-                pServer->disconnect(connInfo.getConnHandle());
-            }
-            delay(10);
-        }
+        // Per-gateway sessions: watchdog, queued requests in order, one chunk per active transfer or listing
+        bool transferring = serviceSessions();
 
-        // Handle file transfers when connected
-        if (deviceConnected && !currentFileName.isEmpty())
+        for (const Session &session : sessions)
         {
-            debug(DebugByte::HUBLINK_TRANSFER_START);
-            Serial.print("Requested file: ");
-            Serial.println(currentFileName);
-
-            // Close any previously open transfer file
-            if (transferFileOpen)
-            {
-                debug(DebugByte::HUBLINK_FILE_CLOSE);
-                transferFile.close();
-                transferFileOpen = false;
-            }
-
-            // Open new file and check if successful
-            debug(DebugByte::HUBLINK_FILE_OPEN);
-            transferFile = SD.open("/" + currentFileName);
-            if (transferFile)
-            {
-                transferFileOpen = true;
-                handleFileTransfer(currentFileName);
-            }
-            else
-            {
-                debug(DebugByte::HUBLINK_FILE_OPEN_ERROR);
-                Serial.println("Failed to open file for transfer");
-            }
-
-            // Clean up after transfer
-            if (transferFileOpen)
+            if (session.listingSent && !successfulTransfer)
             {
-                debug(DebugByte::HUBLINK_FILE_CLOSE);
-                transferFile.close();
-                transferFileOpen = false;
+                debug(DebugByte::HUBLINK_TRANSFER_SUCCESS);
+                successfulTransfer = true;
             }
-            currentFileName = "";
         }
 
-        // once sendFilenames is true
-        if (deviceConnected && currentFileName.isEmpty() && !allFilesSent && sendFilenames)
+        // Apply uploaded settings right away; advertise_for changes also move this loop's deadline
+        if (metaJsonUpdated)
         {
-            debug(DebugByte::HUBLINK_FILE_LIST_START);
-            updateMtuSize();
-            Serial.print("MTU Size (negotiated): ");
-            Serial.println(mtuSize);
-            Serial.println("Sending filenames...");
-
-            // Close any previously open root directory
-            if (rootFileOpen)
-            {
-                debug(DebugByte::HUBLINK_FILE_CLOSE);
-                rootFile.close();
-                rootFileOpen = false;
-            }
-
-            // Open root directory and check if successful
-            debug(DebugByte::HUBLINK_FILE_OPEN);
-            rootFile = SD.open("/");
-            if (rootFile)
-            {
-                rootFileOpen = true;
-                sendAvailableFilenames();
-            }
-            else
-            {
-                debug(DebugByte::HUBLINK_SD_ROOT_ERROR);
-                Serial.println("Failed to open root directory");
-            }
-
-            // Clean up after sending filenames
-            if (rootFileOpen)
-            {
-                debug(DebugByte::HUBLINK_FILE_CLOSE);
-                rootFile.close();
-                rootFileOpen = false;
-            }
-            debug(DebugByte::HUBLINK_FILE_LIST_END);
+            applyMetaJsonSettings();
         }
 
-        if (deviceConnected && allFilesSent)
+        // Nothing else to do until a gateway connects: stage the listing a slice at a time
+        if (prestage_listing && !deviceConnected && !didConnect && stageListing(LISTING_STAGE_SLICE_MS))
         {
-            debug(DebugByte::HUBLINK_TRANSFER_SUCCESS);
-            successfulTransfer = true;
+            prefetchFirstFile();
         }
 
         didConnect |= deviceConnected;
-        delay(100);
+        if (!transferring)
+        {
+            flushTrace(); // UART output only while idle, never between chunks
+            delay(isMetaUploadInProgress() ? 1 : 100); // drain upload packets before the queue fills
+        }
     }
 
     // Final cleanup of any remaining open handles
@@ -960,25 +2540,23 @@ bool Hublink::doBLE()
         rootFile.close();
         rootFileOpen = false;
     }
-    if (transferFileOpen)
-    {
-        debug(DebugByte::HUBLINK_FILE_CLOSE);
-        transferFile.close();
-        transferFileOpen = false;
-    }
+    closeAllSessions();
 
     debug(DebugByte::HUBLINK_BLE_ADV_STOP);
+    switchPhase(SyncPhase::ADVERTISING);
     stopAdvertising();
 
     // Reset alert after sync is complete
-    alert = "";
+    {
+        MutexGuard guard(stateMutex);
+        alert = "";
+    }
 
+    // Catch an upload that completed after the last loop iteration
     if (metaJsonUpdated)
     {
-        debug(DebugByte::HUBLINK_META_JSON_READ);
-        readMetaJson(); // update any new meta.json values
+        applyMetaJsonSettings();
     }
-    metaJsonUpdated = false;
 
     // Ensure cleanup before final return
     if (!successfulTransfer)
@@ -990,15 +2568,100 @@ bool Hublink::doBLE()
     return successfulTransfer;
 }
 
-/**
- * Time units for BLE connection parameters:
- *
- * @param temporaryConnectFor: seconds - Temporary override for advertising duration
- * @param advertise_every: seconds - Time between advertising cycles (set in meta.json)
- * @param advertise_for: seconds - Duration of each advertising cycle (set in meta.json)
- * @param reconnect_every: seconds - Time between reconnection attempts (set in meta.json)
- */
-bool Hublink::sync(uint32_t temporaryConnectFor)
+/**
+ * Time units for BLE connection parameters:
+ *
+ * @param temporaryConnectFor: seconds - Temporary override for advertising duration
+ * @param advertise_every: seconds - Time between advertising cycles (set in meta.json)
+ * @param advertise_for: seconds - Duration of each advertising cycle (set in meta.json)
+ * @param reconnect_every: seconds - Time between reconnection attempts (set in meta.json)
+ */
+// NimBLE runs its host task on this core; keep the sync task next to it and off the loop() core
+#ifdef CONFIG_BT_NIMBLE_PINNED_TO_CORE
+#define HUBLINK_SYNC_CORE CONFIG_BT_NIMBLE_PINNED_TO_CORE
+#else
+#define HUBLINK_SYNC_CORE 0
+#endif
+
+bool Hublink::lockStorage(uint32_t timeoutMs)
+{
+    if (!storageMutex)
+    {
+        return true;
+    }
+    TickType_t ticks = timeoutMs == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+    return xSemaphoreTakeRecursive(storageMutex, ticks) == pdTRUE;
+}
+
+void Hublink::unlockStorage()
+{
+    if (storageMutex)
+    {
+        xSemaphoreGiveRecursive(storageMutex);
+    }
+}
+
+bool Hublink::syncAsync(uint32_t temporaryConnectFor, SyncCompleteCallback callback)
+{
+    if (!initialized)
+    {
+        Serial.println("Error: Hublink not initialized. Call begin() first.");
+        return false;
+    }
+
+    bool idle = false;
+    if (!syncInProgress.compare_exchange_strong(idle, true))
+    {
+        return false; // already syncing
+    }
+
+    asyncConnectFor = temporaryConnectFor;
+    asyncCallback = callback;
+    if (xTaskCreatePinnedToCore(syncTaskEntry, "hublink_sync", SYNC_TASK_STACK_SIZE, this,
+                                SYNC_TASK_PRIORITY, &syncTask, HUBLINK_SYNC_CORE) != pdPASS)
+    {
+        Serial.println("Error: could not start sync task");
+        syncTask = nullptr;
+        syncInProgress = false;
+        return false;
+    }
+    return true;
+}
+
+void Hublink::syncTaskEntry(void *arg)
+{
+    Hublink *self = static_cast<Hublink *>(arg);
+    SyncCompleteCallback callback = self->asyncCallback;
+
+    bool result = self->runSync(self->asyncConnectFor);
+    self->flushTrace();
+    self->lastSyncResult = result;
+    self->syncTask = nullptr;
+    self->syncInProgress = false; // the callback may start the next sync
+
+    if (callback)
+    {
+        callback(result);
+    }
+    vTaskDelete(nullptr);
+}
+
+bool Hublink::sync(uint32_t temporaryConnectFor)
+{
+    bool idle = false;
+    if (!syncInProgress.compare_exchange_strong(idle, true))
+    {
+        return false; // a background sync owns the radio and the card
+    }
+
+    bool result = runSync(temporaryConnectFor);
+    flushTrace();
+    lastSyncResult = result;
+    syncInProgress = false;
+    return result;
+}
+
+bool Hublink::runSync(uint32_t temporaryConnectFor)
 {
     if (!initialized)
     {
@@ -1007,23 +2670,13 @@ bool Hublink::sync(uint32_t temporaryConnectFor)
     }
 
     debug(DebugByte::HUBLINK_BLE_SYNC_START);
-    uint32_t currentTime = millis();
+    // RTC clock keeps counting through deep sleep and does not wrap in practice
+    uint64_t currentTime = rtcMillis();
     bool connectionSuccess = false;
-
-    // Handle millis() overflow safely
-    uint32_t timeSinceLastSync;
-    if (currentTime >= lastHublinkMillis)
-    {
-        timeSinceLastSync = currentTime - lastHublinkMillis;
-    }
-    else
-    {
-        // Handle wrap condition
-        timeSinceLastSync = (0xFFFFFFFF - lastHublinkMillis) + currentTime;
-    }
+    uint64_t timeSinceLastSync = currentTime - scheduler.lastSyncMs;
 
     // Add safety cleanup at start
-    if (!deviceConnected && metaJsonTransferInProgress)
+    if (!deviceConnected && isMetaUploadInProgress())
     {
         debug(DebugByte::HUBLINK_CLEANUP_START);
         if (rootFileOpen)
@@ -1031,79 +2684,87 @@ bool Hublink::sync(uint32_t temporaryConnectFor)
             rootFile.close();
             rootFileOpen = false;
         }
-        if (transferFileOpen)
-        {
-            transferFile.close();
-            transferFileOpen = false;
-        }
+        closeAllSessions(); // drops the sessions' meta.json uploads
         cleanupCallbacks();
-        cleanupMetaJsonTransfer();
         debug(DebugByte::HUBLINK_CLEANUP_COMPLETE, true);
     }
 
     // Add cleanup for early exit conditions
-    if (disable || (temporaryConnectFor == 0 && (currentTime - lastHublinkMillis < advertise_every * 1000)))
+    if (disable || (temporaryConnectFor == 0 && (timeSinceLastSync < advertise_every * 1000ULL)))
     {
         cleanupCallbacks();
         debug(DebugByte::HUBLINK_BLE_SYNC_END);
         return false;
     }
 
-    if (!disable && (temporaryConnectFor > 0 || timeSinceLastSync >= advertise_every * 1000UL))
+    if (!disable && (temporaryConnectFor > 0 || timeSinceLastSync >= advertise_every * 1000ULL))
     {
         // Serial.printf("Time since last sync: %lu ms (threshold: %lu ms)\n",
-        //               currentTime - lastHublinkMillis,
+        //               currentTime - scheduler.lastSyncMs,
         //               advertise_every * 1000);
 
         // Serial.printf("Retry state - attempted: %s, currentAttempt: %d/%d, timeSinceLastRetry: %lu ms\n",
-        //               connectionAttempted ? "true" : "false",
-        //               connectionAttempted ? currentRetryAttempt + 1 : 0,
+        //               scheduler.connectionAttempted ? "true" : "false",
+        //               scheduler.connectionAttempted ? scheduler.currentRetryAttempt + 1 : 0,
         //               reconnect_attempts,
-        //               currentTime - lastRetryMillis);
+        //               currentTime - scheduler.lastRetryMs);
 
-        if (connectionAttempted && currentRetryAttempt >= reconnect_attempts)
+        if (scheduler.connectionAttempted && scheduler.currentRetryAttempt >= reconnect_attempts)
         {
             debug(DebugByte::HUBLINK_WARNING);
             // Serial.println("Max retries reached, resetting retry state");
-            connectionAttempted = false;
-            currentRetryAttempt = 0;
-            lastHublinkMillis = currentTime;
+            scheduler.connectionAttempted = false;
+            scheduler.currentRetryAttempt = 0;
+            scheduler.lastSyncMs = currentTime;
             debug(DebugByte::HUBLINK_BLE_SYNC_END);
             return false;
         }
 
-        if (!connectionAttempted ||
-            (currentRetryAttempt < reconnect_attempts &&
-             currentTime - lastRetryMillis >= reconnect_every * 1000UL)) // Convert to ms here
+        if (!scheduler.connectionAttempted ||
+            (scheduler.currentRetryAttempt < reconnect_attempts &&
+             currentTime - scheduler.lastRetryMs >= reconnect_every * 1000ULL)) // Convert to ms here
         {
             Serial.println("Hublink started advertising... ");
 
-            uint32_t originalConnectFor = advertise_for;
+            temporaryAdvertiseFor = temporaryConnectFor;
             if (temporaryConnectFor > 0)
             {
                 Serial.printf("Using temporary connection duration: %d seconds\n", temporaryConnectFor);
-                advertise_for = temporaryConnectFor;
             }
 
+            // JSON documents made during this sync come from the arena and are dropped with it
+            if (arenaSize > 0 && !arena.begin(arenaSize))
+            {
+                Serial.println("Warning: sync arena allocation failed, using the heap");
+            }
+            arena.open();
+            beginCpuPolicy();
+            beginSyncAccounting();
             connectionSuccess = doBLE();
+            endSyncAccounting();
+            endCpuPolicy();
+            size_t arenaPeak = arena.close();
+            Serial.printf("Sync arena: peak %u of %u bytes, high water %u, overflows %lu\n",
+                          (unsigned)arenaPeak, (unsigned)arena.getCapacity(),
+                          (unsigned)arena.getHighWater(), (unsigned long)arena.getOverflowCount());
 
             if (!connectionSuccess && try_reconnect && temporaryConnectFor == 0) // Only retry if not temporary
             {
                 debug(DebugByte::HUBLINK_WARNING);
-                if (!connectionAttempted)
+                if (!scheduler.connectionAttempted)
                 {
-                    connectionAttempted = true;
-                    currentRetryAttempt = 1;
+                    scheduler.connectionAttempted = true;
+                    scheduler.currentRetryAttempt = 1;
                     Serial.println("First connection attempt failed, enabling retry logic");
                 }
                 else
                 {
-                    currentRetryAttempt++;
+                    scheduler.currentRetryAttempt++;
                     Serial.printf("Retry attempt %d/%d scheduled\n",
-                                  currentRetryAttempt,
+                                  scheduler.currentRetryAttempt,
                                   reconnect_attempts);
                 }
-                lastRetryMillis = currentTime;
+                scheduler.lastRetryMs = currentTime;
             }
             else
             {
@@ -1117,19 +2778,19 @@ bool Hublink::sync(uint32_t temporaryConnectFor)
                     debug(DebugByte::HUBLINK_TRANSFER_FAIL);
                     Serial.println("Retries disabled, not attempting reconnection");
                 }
-                connectionAttempted = false;
-                currentRetryAttempt = 0;
+                scheduler.connectionAttempted = false;
+                scheduler.currentRetryAttempt = 0;
             }
 
-            advertise_for = originalConnectFor;
+            temporaryAdvertiseFor = 0;
 
             Serial.println("Hublink ended advertising.");
-            lastHublinkMillis = millis();
+            scheduler.lastSyncMs = rtcMillis();
         }
         else
         {
             // Serial.printf("Skipping connection attempt - max retries reached or waiting for retry interval (%lu ms remaining)\n",
-            //               reconnect_every - (currentTime - lastRetryMillis));
+            //               reconnect_every - (currentTime - scheduler.lastRetryMs));
         }
     }
     // else
@@ -1140,16 +2801,16 @@ bool Hublink::sync(uint32_t temporaryConnectFor)
     //     }
     //     else
     //     {
-    //         uint32_t timeUntilNext = (advertise_every * 1000) - (currentTime - lastHublinkMillis);
+    //         uint32_t timeUntilNext = (advertise_every * 1000) - (currentTime - scheduler.lastSyncMs);
     //         Serial.printf("Sync skipped - %lu ms until next connection attempt\n", timeUntilNext);
     //     }
     // }
 
-    if (!connectionSuccess && metaJsonTransferInProgress)
+    if (!connectionSuccess && isMetaUploadInProgress())
     {
         debug(DebugByte::HUBLINK_CLEANUP_START);
         // Ensure cleanup if connection attempt failed
-        cleanupMetaJsonTransfer();
+        closeAllSessions();
         debug(DebugByte::HUBLINK_CLEANUP_COMPLETE);
     }
 
@@ -1157,53 +2818,260 @@ bool Hublink::sync(uint32_t temporaryConnectFor)
     return connectionSuccess;
 }
 
-String Hublink::buildNodeCharacteristicJson()
+uint64_t Hublink::getMsUntilNextSync()
 {
-    DynamicJsonDocument doc(512);
+    if (disable)
+    {
+        return advertise_every * 1000ULL; // nothing scheduled; re-check after one interval
+    }
 
-    doc["upload_path"] = upload_path;
-    doc["firmware_version"] = HUBLINK_FIRMWARE_VERSION;
-    doc["battery_level"] = batteryLevel;
+    uint64_t due = scheduler.lastSyncMs + advertise_every * 1000ULL;
+    if (scheduler.connectionAttempted && scheduler.currentRetryAttempt < reconnect_attempts)
+    {
+        due = std::max<uint64_t>(due, scheduler.lastRetryMs + reconnect_every * 1000ULL);
+    }
+
+    uint64_t now = rtcMillis();
+    return due > now ? due - now : 0;
+}
+
+String Hublink::buildNodeCharacteristicJson()
+{
+    HublinkJsonDocument doc(512);
 
-    if (deviceId.length() > 0)
     {
-        doc["device_id"] = deviceId;
+        MutexGuard guard(metaMutex); // derived from meta.json, which loop() may re-read
+        doc["upload_path"] = upload_path;
+        if (deviceId.length() > 0)
+        {
+            doc["device_id"] = deviceId;
+        }
     }
+    doc["firmware_version"] = HUBLINK_FIRMWARE_VERSION;
+    doc["battery_level"] = batteryLevel;
 
-    if (alert.length() > 0)
     {
-        doc["alert"] = alert;
+        MutexGuard guard(stateMutex); // set from loop() during syncAsync()
+        if (alert.length() > 0)
+        {
+            doc["alert"] = alert;
+        }
     }
 
     String jsonString;
     serializeJson(doc, jsonString);
 
-    Serial.printf("Node characteristic JSON: %s\n", jsonString.c_str());
+    HUBLINK_LOGV("Node characteristic JSON: %s\n", jsonString.c_str());
     return jsonString;
 }
 
+// Charge the time since the last switch to the current phase and enter next. @return the phase left
+SyncPhase Hublink::switchPhase(SyncPhase next)
+{
+    if (accountingTask == nullptr || accountingTask != xTaskGetCurrentTaskHandle())
+    {
+        return next; // not syncing, or another task: nothing to charge
+    }
+    uint32_t now = micros();
+    phaseUs[(size_t)currentPhase] += now - phaseStartUs;
+    phaseStartUs = now;
+    SyncPhase previous = currentPhase;
+    currentPhase = next;
+    return previous;
+}
+
+void Hublink::beginSyncAccounting()
+{
+    for (uint64_t &us : phaseUs)
+    {
+        us = 0;
+    }
+    lastSyncStats = {};
+    uint64_t now = rtcMillis();
+    energy.outsideSyncMs += now - std::min(now, energy.lastSyncEndMs);
+    currentPhase = SyncPhase::ADVERTISING; // BLE start is charged to advertising
+    phaseStartUs = micros();
+    accountingTask = xTaskGetCurrentTaskHandle();
+}
+
+void Hublink::endSyncAccounting()
+{
+    switchPhase(SyncPhase::ADVERTISING); // close the running phase
+    accountingTask = nullptr;
+
+    float chargeMah = 0;
+    for (size_t i = 0; i < (size_t)SyncPhase::COUNT; i++)
+    {
+        lastSyncStats.phaseMs[i] = phaseUs[i] / 1000;
+        energy.phaseMs[i] += lastSyncStats.phaseMs[i];
+        chargeMah += lastSyncStats.phaseMs[i] * phase_current_ma[i] / 3600000.0f; // ms * mA -> mAh
+    }
+    lastSyncStats.chargeMah = chargeMah;
+    energy.chargeMah += chargeMah;
+    energy.bytesSent += lastSyncStats.bytesSent;
+    energy.syncs++;
+    energy.lastSyncEndMs = rtcMillis();
+
+    Serial.printf("Sync time (ms): adv %lu, idle %lu, list %lu, xfer %lu, sd %lu, meta %lu; ~%.1f uAh\n",
+                  (unsigned long)lastSyncStats.phaseMs[0], (unsigned long)lastSyncStats.phaseMs[1],
+                  (unsigned long)lastSyncStats.phaseMs[2], (unsigned long)lastSyncStats.phaseMs[3],
+                  (unsigned long)lastSyncStats.phaseMs[4], (unsigned long)lastSyncStats.phaseMs[5],
+                  chargeMah * 1000.0f);
+    if (write_stats_file)
+    {
+        writeStatsFile();
+    }
+}
+
+// One row per sync; the gateway picks the file up (and commits it) at the next sync
+void Hublink::writeStatsFile()
+{
+    MutexGuard guard(storageMutex);
+    if (!beginSD())
+    {
+        return;
+    }
+    const char *path = "/" STATS_FILE_NAME;
+    bool created = !files().exists(path);
+    File file = files().open(path, FILE_APPEND);
+    if (!file)
+    {
+        markSDError();
+        return;
+    }
+    if (created)
+    {
+        file.println("sync,rtc_ms,cpu_mhz,tx_dbm,mtu,advertising_ms,connected_idle_ms,listing_ms,transfer_ms,"
+                     "sd_io_ms,meta_json_ms,bytes_sent,charge_uah,total_charge_uah,outside_sync_ms");
+    }
+    const HublinkSyncStats &sync = lastSyncStats;
+    file.printf("%lu,%llu,%u,%d,%u,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f,%.1f,%llu\n",
+                (unsigned long)energy.syncs, (unsigned long long)energy.lastSyncEndMs,
+                sync.cpuMhz, sync.txPowerDbm, sync.mtu,
+                (unsigned long)sync.phaseMs[0], (unsigned long)sync.phaseMs[1], (unsigned long)sync.phaseMs[2],
+                (unsigned long)sync.phaseMs[3], (unsigned long)sync.phaseMs[4], (unsigned long)sync.phaseMs[5],
+                (unsigned long)sync.bytesSent, sync.chargeMah * 1000.0f, energy.chargeMah * 1000.0,
+                (unsigned long long)energy.outsideSyncMs);
+    file.close();
+    invalidateListing(); // size changed since any staged listing
+}
+
 void Hublink::printMemStats(const char *prefix)
 {
     static uint32_t lastMinFreeHeap = 0;
-    uint32_t currentMinFreeHeap = ESP.getMinFreeHeap();
+    recordMemStats(MemPhase::MANUAL);
+    MemSample sample;
+    {
+        MutexGuard guard(stateMutex);
+        sample = memSamples[(memSampleCount - 1) % HUBLINK_MEM_SAMPLES];
+    }
 
-    Serial.printf("%s - Free: %lu, Min: %lu, Max Block: %lu, PSRAM: %lu",
+    Serial.printf("%s - Free: %lu, Min: %lu, Max Block: %lu, PSRAM: %lu, Stack: %lu",
                   prefix,
-                  ESP.getFreeHeap(),
-                  currentMinFreeHeap,
-                  ESP.getMaxAllocHeap(),
-                  ESP.getFreePsram());
+                  sample.freeHeap,
+                  sample.minFreeHeap,
+                  sample.maxAllocHeap,
+                  sample.freePsram,
+                  sample.stackHighWater);
 
     // Only show the difference if this isn't the first call
     if (lastMinFreeHeap > 0)
     {
-        int32_t diff = currentMinFreeHeap - lastMinFreeHeap;
+        int32_t diff = sample.minFreeHeap - lastMinFreeHeap;
         Serial.printf(", Min Diff: %+ld", diff); // %+ld will show the sign (+ or -) before the number
     }
 
     Serial.println(); // End the line
 
-    lastMinFreeHeap = currentMinFreeHeap;
+    lastMinFreeHeap = sample.minFreeHeap;
+}
+
+// Called from the sync task and the NimBLE host task (connect)
+void Hublink::recordMemStats(MemPhase phase)
+{
+    MemSample sample;
+    sample.ms = millis();
+    sample.phase = phase;
+    sample.freeHeap = ESP.getFreeHeap();
+    sample.maxAllocHeap = ESP.getMaxAllocHeap();
+    sample.minFreeHeap = ESP.getMinFreeHeap();
+    sample.freePsram = ESP.getFreePsram();
+    sample.stackHighWater = uxTaskGetStackHighWaterMark(nullptr); // bytes on the ESP32 port
+
+    MutexGuard guard(stateMutex);
+    memSamples[memSampleCount % HUBLINK_MEM_SAMPLES] = sample;
+    memSampleCount++;
+}
+
+size_t Hublink::getMemSamples(MemSample *out, size_t maxSamples)
+{
+    MutexGuard guard(stateMutex);
+    size_t available = std::min<size_t>(memSampleCount, HUBLINK_MEM_SAMPLES);
+    size_t count = std::min(available, maxSamples);
+    uint32_t first = memSampleCount - count; // newest count readings, oldest first
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = memSamples[(first + i) % HUBLINK_MEM_SAMPLES];
+    }
+    return count;
+}
+
+const char *Hublink::memPhaseName(MemPhase phase)
+{
+    switch (phase)
+    {
+    case MemPhase::BEGIN:
+        return "begin";
+    case MemPhase::START_ADVERTISING:
+        return "startAdvertising";
+    case MemPhase::CONNECT:
+        return "connect";
+    case MemPhase::LISTING:
+        return "listing";
+    case MemPhase::TRANSFER:
+        return "transfer";
+    case MemPhase::STOP_ADVERTISING:
+        return "stopAdvertising";
+    case MemPhase::READ_META_JSON:
+        return "readMetaJson";
+    default:
+        return "manual";
+    }
+}
+
+// "phase|ms|free|maxBlock|minFree|psram|stack" per reading, ';'-separated, oldest first, then "EOF"
+void Hublink::sendMemStats(Session &session)
+{
+    MemSample samples[HUBLINK_MEM_SAMPLES];
+    size_t count = getMemSamples(samples, HUBLINK_MEM_SAMPLES);
+
+    char chunk[MAX_INDICATION_SIZE + 1];
+    size_t size = std::min((size_t)session.mtuSize, sizeof(chunk) - 1);
+    size_t length = 0;
+    for (size_t i = 0; i < count && session.state == SESSION_ACTIVE; i++)
+    {
+        char entry[96];
+        int entryLength = snprintf(entry, sizeof(entry), "%s%s|%lu|%lu|%lu|%lu|%lu|%lu",
+                                   i > 0 ? ";" : "", memPhaseName(samples[i].phase),
+                                   (unsigned long)samples[i].ms, (unsigned long)samples[i].freeHeap,
+                                   (unsigned long)samples[i].maxAllocHeap, (unsigned long)samples[i].minFreeHeap,
+                                   (unsigned long)samples[i].freePsram, (unsigned long)samples[i].stackHighWater);
+        for (int j = 0; j < entryLength; j++)
+        {
+            chunk[length++] = entry[j];
+            if (length == size)
+            {
+                watchdogTimer = millis();
+                sendIndication(session, pFilenameCharacteristic, (const uint8_t *)chunk, length);
+                length = 0;
+            }
+        }
+    }
+    if (length > 0)
+    {
+        sendIndication(session, pFilenameCharacteristic, (const uint8_t *)chunk, length);
+    }
+    sendIndication(session, pFilenameCharacteristic, (const uint8_t *)"EOF", 3);
 }
 
 void Hublink::setTimestampCallback(TimestampCallback callback)
@@ -1223,19 +3091,21 @@ uint8_t Hublink::getBatteryLevel() const
 
 void Hublink::setAlert(const String &alert)
 {
+    MutexGuard guard(stateMutex);
     this->alert = alert;
 }
 
 String Hublink::getAlert() const
 {
+    MutexGuard guard(stateMutex);
     return alert;
 }
 
-void Hublink::handleTimestamp(const String &timestamp)
+void Hublink::handleTimestamp(const char *timestamp)
 {
-    if (_timestampCallback != nullptr && timestamp.length() > 0)
+    if (_timestampCallback != nullptr && timestamp[0] != '\0')
     {
-        uint32_t unix_timestamp = timestamp.toInt();
+        uint32_t unix_timestamp = atol(timestamp);
         _timestampCallback(unix_timestamp);
     }
 }
@@ -1250,16 +3120,19 @@ void Hublink::addValidExtension(const String &extension)
     {
         lowerExt = "." + lowerExt;
     }
+    MutexGuard guard(stateMutex);
     validExtensions.push_back(lowerExt);
 }
 
 void Hublink::clearValidExtensions()
 {
+    MutexGuard guard(stateMutex);
     validExtensions.clear();
 }
 
 void Hublink::addValidExtensions(const std::vector<String> &extensions)
 {
+    MutexGuard guard(stateMutex); // replaced as a whole, never seen half-built
     validExtensions.clear();
     for (const String &ext : extensions)
     {
@@ -1267,8 +3140,9 @@ void Hublink::addValidExtensions(const std::vector<String> &extensions)
     }
 }
 
-const std::vector<String> &Hublink::getValidExtensions() const
+std::vector<String> Hublink::getValidExtensions() const
 {
+    MutexGuard guard(stateMutex);
     return validExtensions;
 }
 
@@ -1318,14 +3192,15 @@ public:
     }
 };
 
-bool Hublink::sendIndication(NimBLECharacteristic *pChar, const uint8_t *data, size_t length)
+// All indications go out from the sync task, one at a time, so one set of callbacks serves every session
+bool Hublink::sendIndication(Session &session, NimBLECharacteristic *pChar, const uint8_t *data, size_t length)
 {
     if (!pChar || !data)
     {
         Serial.println("Warning: Null pointer in sendIndication");
         return false;
     }
-    if (!deviceConnected)
+    if (session.state != SESSION_ACTIVE)
     {
         Serial.println("Warning: Indication attempted while disconnected");
         return false;
@@ -1341,11 +3216,11 @@ bool Hublink::sendIndication(NimBLECharacteristic *pChar, const uint8_t *data, s
     const unsigned long timeout = 1000;
     bool success = false;
 
-    for (int i = 0; i < maxRetries && !success && deviceConnected; i++)
+    for (int i = 0; i < maxRetries && !success && session.state == SESSION_ACTIVE; i++)
     {
         indicationCallbacks.reset();
 
-        if (!pChar->indicate())
+        if (!pChar->indicate(session.connHandle))
         {
             delay(10);
             continue;
@@ -1362,7 +3237,7 @@ bool Hublink::sendIndication(NimBLECharacteristic *pChar, const uint8_t *data, s
     return success;
 }
 
-bool Hublink::beginMetaJsonTransfer()
+bool Hublink::beginMetaJsonTransfer(Session &session)
 {
     if (!beginSD())
     {
@@ -1370,31 +3245,40 @@ bool Hublink::beginMetaJsonTransfer()
         return false;
     }
 
+    // Each gateway uploads into its own temp file; the last to finish replaces meta.json
+    Session::MetaTransfer &meta = session.meta;
+    snprintf(meta.path, sizeof(meta.path), "/meta.json.%u.tmp", (unsigned)(&session - sessions));
+
     // Remove any existing temporary file
-    if (SD.exists(tempMetaJsonPath))
+    if (files().exists(meta.path))
     {
-        SD.remove(tempMetaJsonPath);
+        files().remove(meta.path);
     }
 
-    tempMetaJsonFile = SD.open(tempMetaJsonPath, FILE_WRITE);
-    if (!tempMetaJsonFile)
+    meta.file = files().open(meta.path, FILE_WRITE);
+    if (!meta.file)
     {
         Serial.println("Failed to create temporary meta.json file");
+        markSDError();
         return false;
     }
 
-    metaJsonTransferInProgress = true;
-    lastMetaJsonId = 0;
-    metaJsonLastChunkTime = millis();
+    meta.inProgress = true;
+    meta.lastId = 0;
+    meta.lastChunkTime = millis();
 
-    Serial.println("Meta.json transfer started");
+    Serial.printf("Meta.json transfer started (gateway %u)\n", session.connHandle);
     return true;
 }
 
 bool Hublink::validateJsonStructure(const String &jsonStr)
 {
-    StaticJsonDocument<512> doc;
-    DeserializationError error = deserializeJson(doc, jsonStr);
+    // Only keep the hublink object; the rest is still syntax-checked but not stored
+    StaticJsonDocument<32> filter;
+    filter["hublink"] = true;
+
+    HublinkJsonDocument doc(1024);
+    DeserializationError error = deserializeJson(doc, jsonStr, DeserializationOption::Filter(filter));
 
     if (error)
     {
@@ -1413,41 +3297,55 @@ bool Hublink::validateJsonStructure(const String &jsonStr)
     return true;
 }
 
-bool Hublink::processMetaJsonChunk(const String &data)
+bool Hublink::processMetaJsonChunk(Session &session, const String &data)
 {
-    if (!metaJsonTransferInProgress || !tempMetaJsonFile)
+    Session::MetaTransfer &meta = session.meta;
+    if (!meta.inProgress || !meta.file)
     {
         Serial.println("No active meta.json transfer");
         return false;
     }
 
-    size_t bytesWritten = tempMetaJsonFile.print(data);
+    size_t bytesWritten = meta.file.print(data);
     if (bytesWritten != data.length())
     {
         Serial.println("Failed to write chunk to temporary file");
-        cleanupMetaJsonTransfer();
+        markSDError();
+        cleanupMetaJsonTransfer(session);
         return false;
     }
 
-    metaJsonLastChunkTime = millis();
+    meta.lastChunkTime = millis();
     return true;
 }
 
-bool Hublink::finalizeMetaJsonTransfer()
+bool Hublink::finalizeMetaJsonTransfer(Session &session)
 {
-    if (!metaJsonTransferInProgress || !tempMetaJsonFile)
+    Session::MetaTransfer &meta = session.meta;
+    if (!meta.inProgress || !meta.file)
     {
         return false;
     }
 
-    tempMetaJsonFile.close();
+    meta.file.close();
+    if (!installMetaJson(meta.path))
+    {
+        cleanupMetaJsonTransfer(session);
+        return false;
+    }
+    meta.inProgress = false;
+    meta.binary = false;
+    return true;
+}
 
+bool Hublink::installMetaJson(const char *tempPath)
+{
     // Validate the complete JSON file
-    File validateFile = SD.open(tempMetaJsonPath);
+    File validateFile = files().open(tempPath);
     if (!validateFile)
     {
         Serial.println("Failed to open temp file for validation");
-        cleanupMetaJsonTransfer();
+        files().remove(tempPath);
         return false;
     }
 
@@ -1457,115 +3355,123 @@ bool Hublink::finalizeMetaJsonTransfer()
     if (!validateJsonStructure(jsonContent))
     {
         Serial.println("Invalid JSON structure in transferred file");
-        cleanupMetaJsonTransfer();
+        files().remove(tempPath);
         return false;
     }
 
     String backupPath = String(META_JSON_PATH) + ".bak";
 
     // Backup existing meta.json if it exists
-    if (SD.exists(META_JSON_PATH))
+    if (files().exists(META_JSON_PATH))
     {
-        if (SD.exists(backupPath))
+        if (files().exists(backupPath))
         {
-            SD.remove(backupPath);
+            files().remove(backupPath);
         }
-        SD.rename(META_JSON_PATH, backupPath);
+        files().rename(META_JSON_PATH, backupPath);
     }
 
     // Replace meta.json with new file
-    if (!SD.rename(tempMetaJsonPath, META_JSON_PATH))
+    if (!files().rename(tempPath, META_JSON_PATH))
     {
         Serial.println("Failed to rename temporary file to meta.json");
-        cleanupMetaJsonTransfer();
+        files().remove(tempPath);
         return false;
     }
 
     // Remove backup file after successful transfer
-    if (SD.exists(backupPath))
+    if (files().exists(backupPath))
     {
-        SD.remove(backupPath);
+        files().remove(backupPath);
         Serial.println("Removed backup meta.json file");
     }
 
-    metaJsonTransferInProgress = false;
+    metaJsonUpdated = true;
+    debug(DebugByte::HUBLINK_META_JSON_UPDATE);
     return true;
 }
 
-void Hublink::cleanupMetaJsonTransfer()
+void Hublink::cleanupMetaJsonTransfer(Session &session)
 {
-    if (tempMetaJsonFile)
+    Session::MetaTransfer &meta = session.meta;
+    if (meta.file)
     {
-        tempMetaJsonFile.close();
+        meta.file.close();
     }
 
-    if (SD.exists(tempMetaJsonPath))
+    if (meta.path[0] != '\0' && files().exists(meta.path))
     {
-        SD.remove(tempMetaJsonPath);
+        files().remove(meta.path);
     }
 
     // Reset all meta.json related state
-    metaJsonTransferInProgress = false;
-    lastMetaJsonId = 0;
-    metaJsonLastChunkTime = 0;
+    meta.inProgress = false;
+    meta.binary = false;
+    meta.lastId = 0;
+    meta.lastChunkTime = 0;
+    meta.total = 0;
+    meta.received = 0;
+    meta.lastAck = 0;
+    meta.lastGap = UINT32_MAX;
+    meta.fill = 0;
 
     // Clear the document
+    MutexGuard guard(metaMutex);
     metaDoc.clear();
     metaDocValid = false;
-
-    // Clear the temporary path
-    tempMetaJsonPath = "";
 }
 
-void Hublink::handleMetaJsonChunk(uint32_t id, const String &data)
+void Hublink::handleMetaJsonChunk(Session &session, uint32_t id, const String &data)
 {
-    Serial.printf("Meta.json chunk received - ID: %d, Transfer in progress: %s, Last ID: %d\n",
-                  id, metaJsonTransferInProgress ? "yes" : "no", lastMetaJsonId);
+    PhaseScope phase(*this, SyncPhase::META_JSON);
+    Session::MetaTransfer &meta = session.meta;
+    HUBLINK_LOGV("Meta.json chunk received - ID: %d, Transfer in progress: %s, Last ID: %d\n",
+                 id, meta.inProgress ? "yes" : "no", meta.lastId);
 
     // Check for timeout
-    if (metaJsonTransferInProgress &&
-        (millis() - metaJsonLastChunkTime > META_JSON_TIMEOUT_MS))
+    if (meta.inProgress &&
+        (millis() - meta.lastChunkTime > META_JSON_TIMEOUT_MS))
     {
-        Serial.printf("Meta.json transfer timed out (Last successful ID: %d)\n", lastMetaJsonId);
-        cleanupMetaJsonTransfer();
+        Serial.printf("Meta.json transfer timed out (Last successful ID: %d)\n", meta.lastId);
+        cleanupMetaJsonTransfer(session);
         return;
     }
 
     // Handle EOF
     if (id == 0 && data == "EOF")
     {
-        if (!metaJsonTransferInProgress)
+        if (!meta.inProgress)
         {
             Serial.println("Ignoring EOF - no active transfer");
             return;
         }
 
-        if (lastMetaJsonId == 0)
+        if (meta.lastId == 0)
         {
             Serial.println("Ignoring EOF - no chunks processed");
-            cleanupMetaJsonTransfer();
+            cleanupMetaJsonTransfer(session);
             return;
         }
 
-        if (finalizeMetaJsonTransfer())
+        if (finalizeMetaJsonTransfer(session))
         {
             Serial.println("Meta.json transfer completed successfully");
         }
         else
         {
             Serial.println("Failed to finalize meta.json transfer");
-            cleanupMetaJsonTransfer();
+            cleanupMetaJsonTransfer(session);
         }
         return;
     }
 
     // Handle regular chunks
-    if (!metaJsonTransferInProgress)
+    if (!meta.inProgress)
     {
         if (id == 1)
         {
             Serial.println("Starting new meta.json transfer");
-            if (!beginMetaJsonTransfer())
+            if (!beginMetaJsonTransfer(session))
             {
                 Serial.println("Failed to begin meta.json transfer");
                 return;
@@ -1579,28 +3485,315 @@ void Hublink::handleMetaJsonChunk(uint32_t id, const String &data)
     }
 
     // Verify sequence
-    if (id != lastMetaJsonId + 1)
+    if (id != meta.lastId + 1)
     {
-        Serial.printf("Invalid sequence: expected %d, got %d\n", lastMetaJsonId + 1, id);
-        cleanupMetaJsonTransfer();
+        Serial.printf("Invalid sequence: expected %d, got %d\n", meta.lastId + 1, id);
+        cleanupMetaJsonTransfer(session);
         return;
     }
 
     // Process chunk
-    if (processMetaJsonChunk(data))
+    if (processMetaJsonChunk(session, data))
     {
-        lastMetaJsonId = id;
-        Serial.printf("Successfully processed chunk %d\n", id);
+        meta.lastId = id;
+        HUBLINK_LOGV("Successfully processed chunk %d\n", id);
     }
     else
     {
         Serial.println("Failed to process chunk");
-        cleanupMetaJsonTransfer();
+        cleanupMetaJsonTransfer(session);
+    }
+}
+
+// RFC 7386: objects merge recursively, null deletes, anything else replaces
+static void applyMergePatch(JsonObject target, JsonObjectConst patch)
+{
+    for (JsonPairConst kv : patch)
+    {
+        String key = kv.key().c_str(); // copied into target's pool
+        JsonVariantConst value = kv.value();
+
+        if (value.isNull())
+        {
+            target.remove(key);
+        }
+        else if (value.is<JsonObjectConst>())
+        {
+            JsonObject child = target[key].is<JsonObject>() ? target[key].as<JsonObject>()
+                                                            : target.createNestedObject(key);
+            applyMergePatch(child, value.as<JsonObjectConst>());
+        }
+        else
+        {
+            target[key] = value;
+        }
+    }
+}
+
+bool Hublink::applyMetaJsonPatch(const char *json, size_t jsonLength)
+{
+    PhaseScope phase(*this, SyncPhase::META_JSON);
+    if (isMetaUploadInProgress())
+    {
+        Serial.println("Meta.json patch rejected: transfer in progress");
+        return false;
+    }
+
+    HublinkJsonDocument patchDoc(jsonLength * 2 + 256);
+    DeserializationError error = deserializeJson(patchDoc, json, jsonLength);
+    if (error)
+    {
+        Serial.print("Meta.json patch parse failed: ");
+        Serial.println(error.c_str());
+        return false;
     }
+
+    JsonObjectConst patch = patchDoc["metaJsonPatch"].as<JsonObjectConst>();
+    if (patch.isNull())
+    {
+        Serial.println("Meta.json patch must be a JSON object");
+        return false;
+    }
+
+    MutexGuard guard(metaMutex);
+    if (!metaDocValid)
+    {
+        readMetaJson();
+    }
+
+    HublinkJsonDocument merged(metaDoc.memoryUsage() + patchDoc.memoryUsage() + 512);
+    if (metaDocValid)
+    {
+        merged.set(metaDoc);
+    }
+    else
+    {
+        merged.to<JsonObject>(); // no meta.json yet, patch an empty document
+    }
+    applyMergePatch(merged.as<JsonObject>(), patch);
+
+    size_t length = measureJson(merged);
+    if (merged.overflowed() || length > META_UPLOAD_MAX_SIZE)
+    {
+        Serial.println("Meta.json patch result too large");
+        return false;
+    }
+
+    // Written to a temp file, then the same validate and rename path as full uploads
+    if (!beginSD())
+    {
+        return false;
+    }
+    File tempFile = files().open(tempMetaJsonPath, FILE_WRITE);
+    if (!tempFile)
+    {
+        Serial.println("Failed to create temporary meta.json file");
+        markSDError();
+        return false;
+    }
+    char *buffer = (char *)malloc(length + 1);
+    bool written = buffer != nullptr &&
+                   serializeJson(merged, buffer, length + 1) == length &&
+                   tempFile.write((const uint8_t *)buffer, length) == length;
+    free(buffer);
+    tempFile.close();
+
+    if (!written || !installMetaJson(tempMetaJsonPath.c_str()))
+    {
+        Serial.println("Failed to apply meta.json patch");
+        files().remove(tempMetaJsonPath);
+        return false;
+    }
+
+    Serial.printf("Meta.json patch applied (%u bytes)\n", (unsigned)length);
+    return true;
+}
+
+static uint32_t readLE32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Binary meta.json upload: packets are written without response, queued per gateway by the host
+// task and processed here, on the sync task, in arrival order. Out-of-order data is dropped and
+// answered with an ack for the next expected offset (go-back-N).
+void Hublink::handleMetaUploadPacket(Session &session, const uint8_t *data, size_t length)
+{
+    if (!data || length < META_UPLOAD_HEADER_SIZE)
+    {
+        Serial.println("Meta upload: short packet");
+        return;
+    }
+
+    Session::MetaTransfer &meta = session.meta;
+    uint8_t op = data[0];
+    uint32_t offset = readLE32(data + 1);
+    const uint8_t *payload = data + META_UPLOAD_HEADER_SIZE;
+    size_t payloadLength = length - META_UPLOAD_HEADER_SIZE;
+    watchdogTimer = millis();
+
+    switch (op)
+    {
+    case META_UPLOAD_OP_START:
+        if (meta.inProgress)
+        {
+            cleanupMetaJsonTransfer(session);
+        }
+        if (offset == 0 || offset > META_UPLOAD_MAX_SIZE)
+        {
+            Serial.printf("Meta upload: invalid size %u\n", offset);
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, 0);
+            return;
+        }
+
+        if (!beginMetaJsonTransfer(session))
+        {
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, 0);
+            return;
+        }
+        meta.binary = true;
+        meta.total = offset;
+        Serial.printf("Meta upload started: %u bytes\n", meta.total);
+        notifyMetaUpload(session, META_UPLOAD_STATUS_ACK, 0);
+        break;
+
+    case META_UPLOAD_OP_DATA:
+        if (!meta.inProgress || !meta.binary)
+        {
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, 0);
+            return;
+        }
+        if (offset + payloadLength > meta.lastAck + META_UPLOAD_WINDOW)
+        {
+            // Past the window: the gateway did not wait for an ack; re-ack so it resumes from there
+            debug(DebugByte::HUBLINK_META_JSON_UPLOAD_GAP, false);
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ACK, meta.received);
+            return;
+        }
+        if (offset != meta.received)
+        {
+            // Duplicates are dropped silently; a gap is reported once per missing offset
+            if (offset > meta.received && meta.lastGap != meta.received)
+            {
+                debug(DebugByte::HUBLINK_META_JSON_UPLOAD_GAP, false);
+                meta.lastGap = meta.received;
+                notifyMetaUpload(session, META_UPLOAD_STATUS_ACK, meta.received);
+            }
+            return;
+        }
+        if (payloadLength > meta.total - meta.received || !bufferMetaUpload(session, payload, payloadLength))
+        {
+            Serial.println("Meta upload: failed to buffer chunk");
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, meta.received);
+            cleanupMetaJsonTransfer(session);
+            return;
+        }
+        meta.received += payloadLength;
+        meta.lastGap = UINT32_MAX;
+        meta.lastChunkTime = millis();
+
+        if (meta.received - meta.lastAck >= META_UPLOAD_ACK_INTERVAL)
+        {
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ACK, meta.received);
+        }
+        break;
+
+    case META_UPLOAD_OP_END:
+        if (!meta.inProgress || !meta.binary)
+        {
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, 0);
+            return;
+        }
+        if (meta.received != meta.total)
+        {
+            // Tail was lost; gateway resends from the acked offset and repeats END
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ACK, meta.received);
+            return;
+        }
+        if (!flushMetaUploadSector(session) || !finalizeMetaJsonTransfer(session))
+        {
+            Serial.println("Failed to finalize meta.json upload");
+            notifyMetaUpload(session, META_UPLOAD_STATUS_ERROR, meta.received);
+            cleanupMetaJsonTransfer(session);
+            return;
+        }
+        Serial.printf("Meta upload completed: %u bytes\n", meta.total);
+        notifyMetaUpload(session, META_UPLOAD_STATUS_DONE, meta.total);
+        break;
+
+    case META_UPLOAD_OP_ABORT:
+        Serial.println("Meta upload aborted by gateway");
+        cleanupMetaJsonTransfer(session);
+        break;
+
+    default:
+        Serial.printf("Meta upload: unknown op 0x%02X\n", op);
+        break;
+    }
+}
+
+bool Hublink::bufferMetaUpload(Session &session, const uint8_t *data, size_t length)
+{
+    Session::MetaTransfer &meta = session.meta;
+    while (length > 0)
+    {
+        size_t n = std::min(length, (size_t)META_UPLOAD_SECTOR_SIZE - meta.fill);
+        memcpy(meta.sector + meta.fill, data, n);
+        meta.fill += n;
+        data += n;
+        length -= n;
+
+        if (meta.fill == META_UPLOAD_SECTOR_SIZE && !flushMetaUploadSector(session))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Hublink::flushMetaUploadSector(Session &session)
+{
+    Session::MetaTransfer &meta = session.meta;
+    if (meta.fill == 0)
+    {
+        return true;
+    }
+    if (!meta.file || meta.file.write(meta.sector, meta.fill) != meta.fill)
+    {
+        Serial.println("Failed to write meta upload sector");
+        markSDError();
+        return false;
+    }
+    meta.fill = 0;
+    return true;
+}
+
+// Acks go only to the gateway whose upload they describe
+void Hublink::notifyMetaUpload(Session &session, MetaUploadStatus status, uint32_t offset)
+{
+    if (status == META_UPLOAD_STATUS_ACK)
+    {
+        session.meta.lastAck = offset;
+        debug(DebugByte::HUBLINK_META_JSON_UPLOAD_ACK, false);
+    }
+    if (!pMetaUploadCharacteristic || session.state != SESSION_ACTIVE)
+    {
+        return;
+    }
+
+    uint8_t ack[META_UPLOAD_HEADER_SIZE] = {
+        status,
+        (uint8_t)(offset & 0xFF),
+        (uint8_t)((offset >> 8) & 0xFF),
+        (uint8_t)((offset >> 16) & 0xFF),
+        (uint8_t)((offset >> 24) & 0xFF)};
+    pMetaUploadCharacteristic->setValue(ack, sizeof(ack));
+    pMetaUploadCharacteristic->notify(session.connHandle);
 }
 
 bool Hublink::hasMetaKey(const char *parent, const char *child)
 {
+    MutexGuard guard(metaMutex);
     if (!metaDocValid)
     {
         readMetaJson();
@@ -1615,19 +3808,19 @@ bool Hublink::hasMetaKey(const char *parent, const char *child)
     return parentObj.containsKey(child);
 }
 
-void Hublink::debug(DebugByte byte, bool doDelay)
+void Hublink::flushTrace()
 {
-    if (doDebug)
+#if HUBLINK_TRACE_LEVEL >= HUBLINK_TRACE_EVENTS
+    if (!doDebug)
     {
-        Serial.printf("Debug: 0x%02X\n", static_cast<uint8_t>(byte));
-        Serial1.write(static_cast<uint8_t>(byte));
-        Serial1.write('\n'); // Add newline for our line-based detection
+        return; // events stay in the ring for getTraceEvents()
     }
-    else
+    HublinkTraceEvent event;
+    while (trace.pop(event))
     {
-        if (doDelay)
-        {
-            delay(1);
-        }
+        Serial.printf("Debug: 0x%02X\n", event.code);
+        Serial1.write(event.code);
+        Serial1.write('\n'); // Add newline for our line-based detection
     }
-}
\ No newline at end of file
+#endif
+}
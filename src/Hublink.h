@@ -10,11 +10,36 @@
 #include <SD.h>
 #include <SPI.h>
 #include <esp_sleep.h>
+#include <esp_heap_caps.h>
+#include <esp_pm.h>
+#include <esp_idf_version.h>
+#include <mbedtls/sha256.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <ArduinoJson.h>
+#include "HublinkPathResolver.h"
+#include "HublinkStorage.h"
+#include "HublinkCommandQueue.h"
+#include "HublinkArena.h"
+#include "HublinkTrace.h"
 #include <vector>
 #include <string>
 #include <atomic>
 
+// Power-management configuration type; per target before ESP-IDF 5
+#if ESP_IDF_VERSION_MAJOR >= 5
+typedef esp_pm_config_t HublinkPmConfig;
+#elif CONFIG_IDF_TARGET_ESP32S3
+typedef esp_pm_config_esp32s3_t HublinkPmConfig;
+#elif CONFIG_IDF_TARGET_ESP32C3
+typedef esp_pm_config_esp32c3_t HublinkPmConfig;
+#elif CONFIG_IDF_TARGET_ESP32S2
+typedef esp_pm_config_esp32s2_t HublinkPmConfig;
+#else
+typedef esp_pm_config_esp32_t HublinkPmConfig;
+#endif
+
 #define HUBLINK_FIRMWARE_VERSION "1.0.6" // Sync with library.properties
 
 // BLE UUIDs - Custom service for Hublink data transfer protocol
@@ -43,6 +68,7 @@
 // - Handles: Timestamp sync, file listing requests, meta.json updates, watchdog settings
 // - Payload format: {"timestamp": 1234567890, "sendFilenames": true, "watchdogTimeoutMs": 10000}
 // - Also handles: meta.json chunked transfers with {"metaJsonId": 1, "metaJsonData": "..."}
+// - Also handles: meta.json merge patches (RFC 7386) with {"metaJsonPatch": {"hublink": {"advertise_every": 600}}}
 #define CHARACTERISTIC_UUID_GATEWAY "57617368-5504-0001-8000-00805f9b34fb"
 
 // CHARACTERISTIC_UUID_NODE: Node information and status characteristic
@@ -52,8 +78,53 @@
 // - Used for: Client to understand node's file organization structure
 #define CHARACTERISTIC_UUID_NODE "57617368-5505-0001-8000-00805f9b34fb"
 
+// CHARACTERISTIC_UUID_META_UPLOAD: Binary meta.json upload characteristic
+// - WRITE / WRITE_NR: Client streams raw meta.json bytes without JSON wrapping or escaping
+// - NOTIFY: Server notifies a cumulative ack every META_UPLOAD_ACK_INTERVAL bytes and on completion
+// - Flow control: at most META_UPLOAD_WINDOW bytes past the last ack; data beyond it is dropped and re-acked
+// - Packet format: [op:1][offset:4 LE][payload...] (see MetaUploadOp)
+// - Ack format: [status:1][offset:4 LE] (see MetaUploadStatus); offset is the next byte expected
+#define CHARACTERISTIC_UUID_META_UPLOAD "57617368-5506-0001-8000-00805f9b34fb"
+
 // File paths
 #define META_JSON_PATH "/meta.json"
+#define SD_SCRATCH_PATH "/.hublink_clk" // dot-prefixed so it is never listed
+#define ARCHIVE_DIR "/archive"
+#define DATA_DIR "/data" // root of Hublink-managed shard directories
+#define MANIFEST_PATH "/.hublink_manifest" // "name|size|sha256" per committed file
+#define TRACE_FILE_NAME "hublink_trace.bin" // virtual file: trace events not yet committed
+#define STATS_FILE_NAME "hublink_stats.csv" // per-sync time/charge rows, see write_stats_file
+
+// Pass as clockFrequency to negotiate the fastest stable SD SPI clock in beginSD()
+#define HUBLINK_SD_CLOCK_AUTO 0
+
+// Gateways that can be connected at the same time; each has its own request queue and transfer
+#ifndef HUBLINK_MAX_SESSIONS
+#define HUBLINK_MAX_SESSIONS 2
+#endif
+
+// Binary meta.json upload protocol
+#define META_UPLOAD_HEADER_SIZE 5        // op + 32-bit offset
+#define META_UPLOAD_SECTOR_SIZE 512      // SD writes are buffered to whole sectors
+#define META_UPLOAD_ACK_INTERVAL 2048    // cumulative ack cadence in bytes
+#define META_UPLOAD_WINDOW 4096          // max unacked bytes a gateway may have in flight
+#define META_UPLOAD_MAX_SIZE 8192        // readMetaJson() parses with up to 2x this capacity
+static_assert(META_UPLOAD_ACK_INTERVAL < META_UPLOAD_WINDOW, "the node must ack before a full window is in flight");
+
+enum MetaUploadOp : uint8_t
+{
+    META_UPLOAD_OP_START = 0x01, // offset = total length in bytes, no payload
+    META_UPLOAD_OP_DATA = 0x02,  // offset = position of payload in file
+    META_UPLOAD_OP_END = 0x03,   // offset = total length; validates and commits
+    META_UPLOAD_OP_ABORT = 0x04
+};
+
+enum MetaUploadStatus : uint8_t
+{
+    META_UPLOAD_STATUS_ACK = 0x00,  // all bytes before offset are buffered; resume from offset on gaps
+    META_UPLOAD_STATUS_DONE = 0x01, // meta.json replaced
+    META_UPLOAD_STATUS_ERROR = 0xE0 // transfer aborted; restart with META_UPLOAD_OP_START
+};
 
 // CPU Frequency options that maintain radio functionality
 // hublink.setCPUFrequency(CPUFrequency::MHz_80);
@@ -64,6 +135,38 @@ enum class CPUFrequency : uint32_t
     MHz_240 = 240  // Maximum frequency
 };
 
+// What happens to a file once the gateway confirms it is stored (gateway "commitFile")
+// hublink.commit_policy = CommitPolicy::ARCHIVE; or "commit_policy": "archive" in meta.json
+enum class CommitPolicy : uint8_t
+{
+    NONE = 0,     // ignore commits; files stay in the live listing
+    ARCHIVE = 1,  // move to ARCHIVE_DIR (default)
+    DELETE = 2,   // remove from the card
+    MANIFEST = 3  // leave in place, record name+size in MANIFEST_PATH and hide from listings until it grows
+};
+
+// How Hublink-managed data files are spread over subdirectories of DATA_DIR
+// hublink.shard_mode = ShardMode::DAY; or "shard_mode": "day" in meta.json
+enum class ShardMode : uint8_t
+{
+    NONE = 0,  // files live in the root directory (default)
+    DAY = 1,   // one directory per UTC day: /data/YYYYMMDD/
+    COUNT = 2  // shard_size files per directory: /data/000001/
+};
+
+// Points in a sync where memory is sampled (see Hublink::getMemSamples)
+enum class MemPhase : uint8_t
+{
+    BEGIN = 0,
+    START_ADVERTISING = 1,
+    CONNECT = 2,
+    LISTING = 3,
+    TRANSFER = 4, // after each file transfer
+    STOP_ADVERTISING = 5,
+    READ_META_JSON = 6,
+    MANUAL = 7 // printMemStats()
+};
+
 // Debug byte map for Serial1 debugging
 enum DebugByte : uint8_t
 {
@@ -90,6 +193,7 @@ enum DebugByte : uint8_t
     HUBLINK_BLE_ADV_SET_NAME = 0x1C,
     HUBLINK_BLE_ADV_START = 0x1D,
     HUBLINK_BLE_ADV_STOP = 0x1E,
+    HUBLINK_BLE_CREATE_CHAR_META_UPLOAD = 0x1F,
 
     // BLE connection events (0x20-0x2F)
     HUBLINK_BLE_CONNECT = 0x20,
@@ -97,6 +201,7 @@ enum DebugByte : uint8_t
     HUBLINK_BLE_ERROR = 0x22,
     HUBLINK_BLE_MTU_UPDATE = 0x23,
     HUBLINK_BLE_PARAMS_UPDATE = 0x24,
+    HUBLINK_BLE_COMMAND_DROPPED = 0x25,
 
     // BLE sync events (0x30-0x3F)
     HUBLINK_BLE_SYNC_START = 0x30,
@@ -126,6 +231,8 @@ enum DebugByte : uint8_t
     HUBLINK_META_JSON_READ = 0x61,
     HUBLINK_META_JSON_READ_ERROR = 0x62,
     HUBLINK_META_JSON_PARSE_ERROR = 0x63,
+    HUBLINK_META_JSON_UPLOAD_ACK = 0x64,
+    HUBLINK_META_JSON_UPLOAD_GAP = 0x65,
 
     // Sleep events (0x70-0x7F)
     HUBLINK_SLEEP_ENTER = 0x70,
@@ -151,7 +258,9 @@ enum DebugByte : uint8_t
     HUBLINK_TRANSFER_CHUNK_START = 0xA5,
     HUBLINK_TRANSFER_CHUNK_SENT = 0xA6,
     HUBLINK_TRANSFER_EOF_SENT = 0xA7,
-    HUBLINK_TRANSFER_INDICATION_FAIL = 0xA8
+    HUBLINK_TRANSFER_INDICATION_FAIL = 0xA8,
+    HUBLINK_TRANSFER_COMMIT = 0xA9,
+    HUBLINK_TRANSFER_COMMIT_FAIL = 0xAA
 };
 
 // Forward declare callback classes
@@ -159,56 +268,299 @@ class HublinkServerCallbacks;
 class HublinkFilenameCallbacks;
 class HublinkGatewayCallbacks;
 class HublinkIndicationCallbacks;
+class HublinkMetaUploadCallbacks;
 
 // Add near the top with other definitions
 typedef void (*TimestampCallback)(uint32_t timestamp);
+typedef void (*SyncCompleteCallback)(bool success);
+
+// sync() scheduler state, kept in RTC memory so it survives deep sleep.
+// Times are on the RTC clock (ms), which keeps counting while asleep.
+struct HublinkSchedulerState
+{
+    uint32_t magic = 0;
+    uint64_t lastSyncMs = 0;  // end of the last advertising cycle
+    uint64_t lastRetryMs = 0; // start of the last failed attempt
+    bool connectionAttempted = false;
+    uint8_t currentRetryAttempt = 0;
+};
+
+// Exclusive states a sync's time is charged to (see Hublink::getLastSyncStats)
+enum class SyncPhase : uint8_t
+{
+    ADVERTISING = 0,    // BLE up, no gateway; includes BLE start/stop
+    CONNECTED_IDLE = 1, // gateway connected, nothing to do
+    LISTING = 2,
+    TRANSFER = 3,  // sending chunks (SD reads excluded)
+    SD_IO = 4,     // transfer reads, commits
+    META_JSON = 5, // reading, patching and applying meta.json
+    COUNT = 6
+};
+
+struct HublinkSyncStats
+{
+    uint32_t phaseMs[(size_t)SyncPhase::COUNT];
+    uint32_t bytesSent;
+    uint16_t cpuMhz;  // when advertising started
+    int8_t txPowerDbm; // when advertising started
+    uint16_t mtu;     // largest chunk payload used
+    float chargeMah;  // estimate from phase_current_ma
+};
+
+// Totals since power-on, kept in RTC memory across deep sleep
+struct HublinkEnergyTotals
+{
+    uint32_t magic = 0;
+    uint32_t syncs = 0;
+    uint64_t phaseMs[(size_t)SyncPhase::COUNT] = {0};
+    uint64_t bytesSent = 0;
+    uint64_t outsideSyncMs = 0; // between syncs (sketch and sleep), not estimated
+    uint64_t lastSyncEndMs = 0; // RTC clock
+    double chargeMah = 0;
+};
+
+// One memory reading. The stack figure is for the task that took the sample:
+// the NimBLE host task for CONNECT, the sync task (or loop task) otherwise.
+struct MemSample
+{
+    uint32_t ms;
+    MemPhase phase;
+    uint32_t freeHeap;
+    uint32_t maxAllocHeap; // largest free block
+    uint32_t minFreeHeap;  // low-water mark since boot
+    uint32_t freePsram;
+    uint32_t stackHighWater; // bytes of stack never used by the sampling task
+};
+
+#ifndef HUBLINK_TRACE_EVENTS_KEPT
+#define HUBLINK_TRACE_EVENTS_KEPT 128 // trace ring size, power of two
+#endif
+
+#ifndef HUBLINK_MEM_SAMPLES
+#define HUBLINK_MEM_SAMPLES 32 // readings kept, oldest overwritten first
+#endif
 
 class Hublink
 {
 public:
     // Constructor & core functions
     Hublink(uint8_t chipSelect = SS, uint32_t clockFrequency = 1000000);
-    bool doDebug = false;
-    void debug(DebugByte byte, bool doDelay = true);
+    bool doDebug = false; // drain trace events to Serial1 (and Serial) as they are flushed
+
+    /**
+     * Record a trace event. Appends to the trace ring and returns; nothing is written to a UART
+     * here. Compiles to nothing with HUBLINK_TRACE_LEVEL 0. doDelay is kept for compatibility.
+     */
+    void debug(DebugByte byte, bool doDelay = true)
+    {
+#if HUBLINK_TRACE_LEVEL >= HUBLINK_TRACE_EVENTS
+        trace.push(static_cast<uint8_t>(byte));
+#endif
+        (void)byte;
+        (void)doDelay;
+    }
+
+    /** Record a trace event with a value (byte count, error code, ...; saturated at 0xFFFF). */
+    void debugValue(DebugByte byte, uint32_t value)
+    {
+#if HUBLINK_TRACE_LEVEL >= HUBLINK_TRACE_EVENTS
+        trace.push(static_cast<uint8_t>(byte), value > 0xFFFF ? 0xFFFF : (uint16_t)value);
+#endif
+        (void)byte;
+        (void)value;
+    }
+
+    /**
+     * List the trace events a gateway has not yet committed as the virtual file
+     * "hublink_trace.bin" (see README, Trace file). The ring lives in RTC memory, so the events
+     * of a sync that failed, or of the boot before a reset, are offered at the next connection.
+     */
+    bool offer_trace_file = false;
+
+    /** Write undrained trace events to Serial1/Serial if doDebug. Called by Hublink outside the transfer path. */
+    void flushTrace();
+
+    /** Latest trace events (oldest first), drained or not. @return number copied */
+    size_t getTraceEvents(HublinkTraceEvent *out, size_t maxEvents) { return trace.copy(out, maxEvents); }
+    uint32_t getTraceLostCount() const { return trace.getLost(); }
 
     // BLE control (advName is used for BLE device / scan name and overrides hublink.advertise in meta.json)
     bool begin(String advName = "HUBLINK");
     bool beginSD();
+
+    /**
+     * Use a different storage backend (SD_MMC, LittleFS, POSIX directory) instead of SD over SPI.
+     * Call before begin(); the backend must outlive this Hublink instance. See HublinkStorage.h.
+     */
+    void setStorage(HublinkStorage &backend);
+    HublinkStorage &getStorage() { return *storage; }
+
+    /**
+     * Optional card-detect switch. When set, a removal or insertion forces beginSD() to re-mount.
+     * @param pin GPIO of the card-detect switch, or -1 to disable
+     * @param activeLevel pin level when a card is present (switch to GND with pull-up: LOW)
+     */
+    void setCardDetectPin(int8_t pin, uint8_t activeLevel = LOW);
+    uint32_t getSDRemountCount() const { return sdRemountCount; }
+    /**
+     * SD SPI clock in use; with HUBLINK_SD_CLOCK_AUTO this is the negotiated rate.
+     * Returns 0 while Hublink did not mount the card itself (the sketch mounted SD first,
+     * or another storage backend is set), since the clock is then unknown.
+     */
+    uint32_t getSDClockFrequency() const { return sdClockManaged ? clkFreq : 0; }
     void startAdvertising();
     void stopAdvertising();
-    void updateMtuSize();
+
+    /**
+     * Keep the NimBLE stack and GATT database alive between sync() cycles and only
+     * start/stop advertising. Saves the init/deinit cost (and heap churn) every cycle.
+     * Call endBLE() before deep sleep to fully tear the stack down.
+     */
+    bool persistentBLE = false;
+    void endBLE();
+    unsigned long getLastBLEStartMicros() const { return lastBLEStartMicros; }
+    unsigned long getLastBLEStopMicros() const { return lastBLEStopMicros; }
     String readMetaJson();
 
     // Connection events
-    void onConnect();
-    void onDisconnect();
+    void onConnect(uint16_t connHandle);
+    void onDisconnect(uint16_t connHandle);
 
-    // File handling
-    void handleFileTransfer(String fileName);
-    void sendAvailableFilenames();
-    bool isValidFile(String fileName);
-    String parseGateway(NimBLECharacteristic *pCharacteristic, const String &key);
+    /** Gateways currently connected (at most HUBLINK_MAX_SESSIONS). */
+    uint8_t getActiveSessionCount() const;
+
+    /**
+     * Size of the SD read-ahead buffer used by file transfers (4-32 KB, rounded to 512-byte sectors).
+     * The buffer is placed in PSRAM when available and kept between transfers.
+     */
+    void setReadAheadSize(size_t bytes);
+    size_t getReadAheadSize() const { return readAheadSize; }
+    bool isValidFile(const String &fileName);
+    bool isValidFile(const char *fileName);
+
+    /**
+     * Build the file listing (and read the first chunk of the first listed file) in short
+     * slices while advertising, so the reply to sendFilenames and the first transfer start
+     * without waiting on the SD card.
+     */
+    bool prestage_listing = true;
+
+    /**
+     * Live files are being appended to (e.g. by HublinkLogger) and are left out of listings
+     * and commits until sealed. With offer_live_files, a live file is listed anyway and its
+     * transfer stops at the length listed (a snapshot).
+     */
+    bool offer_live_files = false;
+    void setFileLive(const String &fileName, bool live);
+    bool isFileLive(const String &fileName);
+    bool isFileLive(const char *fileName);
+
+    /**
+     * A writer has fileName open (e.g. a HublinkLogger without rotation). The file is still
+     * listed and transferred, but commits are refused so the commit policy never renames or
+     * removes it under the writer.
+     */
+    void setFileWriterOpen(const String &fileName, bool open);
+    bool isFileWriterOpen(const String &fileName);
+    bool isFileWriterOpen(const char *fileName);
+
+    /** True if fileName exists in the root or any shard directory. */
+    bool dataFileExists(const String &fileName);
+    bool commitFile(const char *fileName, const char *digest = "");
+
+    /** Gateway/filename writes lost because a gateway's command queue was full (or a write was too long). */
+    uint32_t getDroppedCommandCount() const { return droppedCommands; }
+
+    /**
+     * Size of the per-sync arena that JSON documents are taken from during a sync (0 = use the heap).
+     * Allocated at the first sync (PSRAM preferred) and kept; everything in it is dropped when the
+     * sync ends. Size it from getArenaHighWater() after a representative run.
+     */
+    void setArenaSize(size_t bytes);
+    size_t getArenaSize() const { return arenaSize; }
+    size_t getArenaPeak() const { return arena.getPeak(); }           // last sync
+    size_t getArenaHighWater() const { return arena.getHighWater(); } // all syncs since boot
+    uint32_t getArenaOverflowCount() const { return arena.getOverflowCount(); }
+
+    /**
+     * Memory readings taken at begin, start/stop of advertising, connect, listing, each transfer
+     * and readMetaJson, kept in a ring of HUBLINK_MEM_SAMPLES. Copies up to maxSamples, oldest
+     * first. A gateway can fetch the same readings with {"memStats": true}.
+     * @return number copied
+     */
+    size_t getMemSamples(MemSample *out, size_t maxSamples);
+    uint32_t getMemSampleCount() const { return memSampleCount; }
+
+    /**
+     * Time accounting: each sync's time is split across SyncPhase states and multiplied by
+     * phase_current_ma (average draw in each state, mA, at your CPU frequency and TX power;
+     * the defaults are rough ESP32 figures; measure your board to calibrate) to estimate
+     * the charge per sync. Totals accumulate across syncs and deep sleep.
+     */
+    float phase_current_ma[(size_t)SyncPhase::COUNT] = {30.0f, 35.0f, 55.0f, 60.0f, 65.0f, 45.0f};
+    const HublinkSyncStats &getLastSyncStats() const { return lastSyncStats; }
+    const HublinkEnergyTotals &getEnergyTotals() const { return energy; }
+
+    /** Append one row per sync to STATS_FILE_NAME, which is listed and synced like any data file. */
+    bool write_stats_file = false;
+    static const char *memPhaseName(MemPhase phase);
 
     // Public state variables
-    String currentFileName;
-    bool deviceConnected = false;
-    bool sendFilenames = false;
-    std::vector<String> validExtensions = {".txt", ".csv", ".log", ".json"};
+    bool deviceConnected = false; // any gateway connected; per-gateway state lives in its session
+    std::vector<String> validExtensions = {".txt", ".csv", ".log", ".json"}; // change with addValidExtension() etc. while syncing
     bool initialized = false;
 
     // BLE configuration
     String advertise;
 
+    /**
+     * During sync, idle at 80 MHz (advertising, waiting on the gateway) and run at 240 MHz only
+     * while listing, hashing or transferring a file. Uses an ESP-IDF power-management lock, so an
+     * app that enables automatic light sleep keeps it; without power management support the
+     * clock is switched directly. The configuration in effect before the sync is restored after it.
+     */
+    bool auto_cpu_frequency = false;
+
     void sleep(uint64_t milliseconds);
     void setCPUFrequency(CPUFrequency freq_mhz);
     bool doBLE();
     bool sync(uint32_t temporaryConnectFor = 0);
 
+    /**
+     * Run sync() on a background task pinned to the BLE host core and return immediately,
+     * so loop() keeps sampling while the node advertises and transfers. The callback, if
+     * given, runs on the sync task once it finishes. Do not sleep while isSyncing().
+     *
+     * @return false if not initialized, a sync is already running, or the task could not start
+     */
+    bool syncAsync(uint32_t temporaryConnectFor = 0, SyncCompleteCallback callback = nullptr);
+    bool isSyncing() const { return syncInProgress; }
+    bool getLastSyncResult() const { return lastSyncResult; }
+
+    /**
+     * Storage lock shared with the sync task. Hublink holds it while mounting/re-mounting the
+     * card and while updating the shard index; take it in the sketch around anything that
+     * must not overlap those (e.g. ending or re-mounting the card yourself).
+     */
+    bool lockStorage(uint32_t timeoutMs = portMAX_DELAY);
+    void unlockStorage();
+
+    /**
+     * Time until sync() next has work to do (advertise or retry), in ms.
+     * Scheduler state lives in RTC memory, so a node can deep sleep for exactly this long
+     * (clamp 0, "due now", to a short minimum so it does not wake immediately in a loop):
+     *
+     * esp_sleep_enable_timer_wakeup(std::max<uint64_t>(hublink.getMsUntilNextSync(), 1000) * 1000ULL);
+     * esp_deep_sleep_start();
+     */
+    uint64_t getMsUntilNextSync();
+
     // Make callback classes friends
     friend class HublinkServerCallbacks;
     friend class HublinkFilenameCallbacks;
     friend class HublinkGatewayCallbacks;
     friend class HublinkIndicationCallbacks;
+    friend class HublinkMetaUploadCallbacks;
 
     // Public methods
     void setTimestampCallback(TimestampCallback callback);
@@ -219,8 +571,9 @@ public:
     void addValidExtension(const String &extension);
     void clearValidExtensions();
     void addValidExtensions(const std::vector<String> &extensions);
-    const std::vector<String> &getValidExtensions() const;
-    void handleMetaJsonChunk(uint32_t id, const String &data);
+    std::vector<String> getValidExtensions() const; // a copy: the sync task reads the list concurrently
+    bool applyMetaJsonPatch(const char *json, size_t jsonLength);
+    bool applyMetaJsonPatch(const std::string &rawValue) { return applyMetaJsonPatch(rawValue.data(), rawValue.size()); }
 
     // BLE configuration (initialized with defaults)
     uint32_t advertise_every = DEFAULT_ADVERTISE_EVERY;
@@ -231,6 +584,20 @@ public:
     bool try_reconnect = DEFAULT_TRY_RECONNECT;
     uint8_t reconnect_attempts = DEFAULT_RECONNECT_ATTEMPTS;
     uint32_t reconnect_every = DEFAULT_RECONNECT_EVERY;
+    CommitPolicy commit_policy = DEFAULT_COMMIT_POLICY;
+    ShardMode shard_mode = DEFAULT_SHARD_MODE;
+    uint16_t shard_size = DEFAULT_SHARD_SIZE;
+
+    /**
+     * Path for a Hublink-managed data file, placed in a shard directory per shard_mode.
+     * Names must be unique across shards; asking again for a known name returns its existing path.
+     * Listings and transfers find these files through an in-memory shard index rather than a
+     * directory scan, and committed (archived/deleted) files drop out of the index. A new name
+     * joins the index once its file exists on the card.
+     *
+     * File f = SD.open(hublink.getDataFilePath("fed_20261018.csv"), FILE_APPEND);
+     */
+    String getDataFilePath(const String &fileName);
 
     /** Max idle time (ms) while connected before forcing disconnect; increase for slow/manual transfer flows. Gateway JSON may still override via watchdogTimeoutMs. */
     uint32_t watchdogTimeoutMs = 10000;
@@ -266,6 +633,7 @@ public:
     template <typename T>
     T getMeta(const char *parent, const char *child)
     {
+        MutexGuard guard(metaMutex); // a background sync may re-read meta.json
         if (!metaDocValid)
         {
             readMetaJson();
@@ -288,32 +656,99 @@ public:
     }
 
 protected:
+    // Scoped recursive-mutex lock; a no-op before begin() creates the mutex
+    struct MutexGuard
+    {
+        SemaphoreHandle_t mutex;
+        explicit MutexGuard(SemaphoreHandle_t m) : mutex(m)
+        {
+            if (mutex)
+                xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+        }
+        ~MutexGuard()
+        {
+            if (mutex)
+                xSemaphoreGiveRecursive(mutex);
+        }
+    };
+
     // BLE characteristics
     NimBLECharacteristic *pFilenameCharacteristic = nullptr;
     NimBLECharacteristic *pFileTransferCharacteristic = nullptr;
     NimBLECharacteristic *pConfigCharacteristic = nullptr;
     NimBLECharacteristic *pNodeCharacteristic = nullptr;
+    NimBLECharacteristic *pMetaUploadCharacteristic = nullptr;
     NimBLEServer *pServer = nullptr;
     NimBLEService *pService = nullptr;
 
-    // Helper function for reliable indications
-    bool sendIndication(NimBLECharacteristic *pChar, const uint8_t *data, size_t length);
-
     // State tracking
     String macAddress;
     bool piReadyForFilenames;
-    bool allFilesSent;
     unsigned long watchdogTimer;
 
-    // MTU configuration
-    uint16_t mtuSize = 20;
+    // MTU configuration (the negotiated size is kept per session)
     const uint16_t NEGOTIATE_MTU_SIZE = 515; // 512 + MTU_HEADER_SIZE
     const uint16_t MTU_HEADER_SIZE = 3;
+    static constexpr size_t MAX_INDICATION_SIZE = 512; // payload of one indication at NEGOTIATE_MTU_SIZE
+
+    // SD read-ahead for file transfers
+    static constexpr size_t SD_SECTOR_SIZE = 512;
+    static constexpr size_t READ_AHEAD_MIN = 4096;
+    static constexpr size_t READ_AHEAD_MAX = 32768;
+    size_t readAheadSize = 8192;
+    HublinkArena arena;
+    size_t arenaSize = 16384; // readMetaJson() alone may take up to 16 KB
+    size_t readAheadAllocated = 0;
+    uint8_t *readAheadBuffer = nullptr;
+    uint8_t *acquireReadAheadBuffer();
+    void releaseReadAheadBuffer();
+
+    // Listing staged during the advertising window; rootFile stays open while a scan is partial
+    static constexpr unsigned long LISTING_STAGE_SLICE_MS = 50;
+    String stagedListing;
+    static constexpr size_t LISTING_RESERVE = 1024; // initial listing capacity; grows once if needed
+    bool listingStaged = false;
+    bool listingStale = false; // invalidated while a gateway was part-way through it
+    bool prefetchAttempted = false;
+    String prefetchName; // file whose first bytes are in readAheadBuffer
+    size_t prefetchLength = 0;
+    size_t prefetchFileSize = 0;
+    bool stageListing(unsigned long budgetMs);
+    void prefetchFirstFile();
+    void invalidateListing();
 
     // SD card configuration
     uint8_t cs;
     uint32_t clkFreq;
 
+    // SD mount health; beginSD() skips probing while the mount is known good
+    bool sdMountHealthy = false;
+    bool sdNeedsRemount = false;
+    uint32_t sdRemountCount = 0;
+    int8_t cardDetectPin = -1;
+    uint8_t cardDetectActiveLevel = LOW;
+    bool cardPresent = true;
+    void markSDError();
+
+    // SD clock negotiation (HUBLINK_SD_CLOCK_AUTO)
+    static constexpr uint32_t SD_CLOCK_STEPS[] = {1000000, 4000000, 8000000, 10000000, 20000000, 26000000, 40000000};
+    static constexpr uint8_t SD_CLOCK_STEP_COUNT = sizeof(SD_CLOCK_STEPS) / sizeof(SD_CLOCK_STEPS[0]);
+    static constexpr size_t SD_SCRATCH_SIZE = 512;
+    static constexpr uint32_t SD_SCRATCH_SEED = 0x48554221;
+    bool sdClockAuto = false;
+    bool sdClockNegotiated = false;
+    bool sdClockManaged = false; // Hublink mounted the card, so clkFreq is the clock in use
+    uint8_t sdClockStep = 0;
+    uint8_t sdClockCeiling = SD_CLOCK_STEP_COUNT - 1;
+    bool negotiateSDClock();
+
+    // Storage backend; defaults to SD over SPI built from the constructor arguments
+    HublinkSDStorage sdStorage;
+    HublinkStorage *storage;
+    fs::FS &files() { return storage->fs(); }
+    bool mountSDAt(uint32_t frequency);
+    bool verifySDScratch();
+
     // Node content handling
     String metaJson;
     String configuredAdvName = "";
@@ -323,41 +758,146 @@ protected:
 
     // Helper functions
     void resetBLEState();
+    void applyMetaJsonSettings();
 
-    unsigned long lastHublinkMillis;
+    // Settings meta.json has overridden, and the values they had before (set in code or defaults).
+    // Only these revert when meta.json changes; fields the sketch assigns are otherwise left alone.
+    enum MetaKey : uint16_t
+    {
+        META_KEY_ADVERTISE_EVERY = 1 << 0,
+        META_KEY_ADVERTISE_FOR = 1 << 1,
+        META_KEY_DISABLE = 1 << 2,
+        META_KEY_UPLOAD_PATH = 1 << 3,
+        META_KEY_APPEND_PATH = 1 << 4,
+        META_KEY_TRY_RECONNECT = 1 << 5,
+        META_KEY_RECONNECT_ATTEMPTS = 1 << 6,
+        META_KEY_RECONNECT_EVERY = 1 << 7,
+        META_KEY_COMMIT_POLICY = 1 << 8,
+        META_KEY_SHARD_MODE = 1 << 9,
+        META_KEY_SHARD_SIZE = 1 << 10
+    };
+    struct MetaBaseline
+    {
+        uint32_t advertise_every = DEFAULT_ADVERTISE_EVERY;
+        uint32_t advertise_for = DEFAULT_ADVERTISE_FOR;
+        bool disable = DEFAULT_DISABLE;
+        String upload_path = DEFAULT_UPLOAD_PATH;
+        String append_path = DEFAULT_APPEND_PATH;
+        bool try_reconnect = DEFAULT_TRY_RECONNECT;
+        uint8_t reconnect_attempts = DEFAULT_RECONNECT_ATTEMPTS;
+        uint32_t reconnect_every = DEFAULT_RECONNECT_EVERY;
+        CommitPolicy commit_policy = DEFAULT_COMMIT_POLICY;
+        ShardMode shard_mode = DEFAULT_SHARD_MODE;
+        uint16_t shard_size = DEFAULT_SHARD_SIZE;
+    };
+    uint16_t metaAppliedKeys = 0;
+    MetaBaseline metaBaseline;
+    void revertMetaSettings();
+    void updateNodeCharacteristic();
+
+    // Scheduler state (lastSyncMs, retries) lives in RTC memory, see HublinkSchedulerState
+    HublinkSchedulerState &scheduler;
+    static constexpr uint32_t SCHEDULER_MAGIC = 0x48554231; // "HUB1"
+    static uint64_t rtcMillis();
 
     void printMemStats(const char *prefix);
+    void recordMemStats(MemPhase phase);
+
+    // Sync time accounting; phases switch only on the task running the sync
+    HublinkEnergyTotals &energy;
+    static constexpr uint32_t ENERGY_MAGIC = 0x48454E31; // "HEN1"
+    HublinkSyncStats lastSyncStats = {};
+    uint64_t phaseUs[(size_t)SyncPhase::COUNT] = {0};
+    SyncPhase currentPhase = SyncPhase::ADVERTISING;
+    uint32_t phaseStartUs = 0;
+    TaskHandle_t accountingTask = nullptr;
+    SyncPhase switchPhase(SyncPhase next);
+    void beginSyncAccounting();
+    void endSyncAccounting();
+    void writeStatsFile();
+
+    // Automatic CPU frequency during sync (auto_cpu_frequency)
+    static constexpr uint32_t CPU_IDLE_MHZ = 80;
+    static constexpr uint32_t CPU_BOOST_MHZ = 240;
+    esp_pm_lock_handle_t cpuBoostLock = nullptr;
+    bool cpuPolicyActive = false;
+    bool cpuPolicyUsesPm = false; // false: switching with setCpuFrequencyMhz()
+    uint32_t cpuRestoreMhz = 0;
+    HublinkPmConfig cpuRestorePm = {}; // configuration before the sync, restored as is
+    std::atomic<uint8_t> cpuBoostDepth{0};
+    void beginCpuPolicy();
+    void endCpuPolicy();
+    void cpuBoost();
+    void cpuRelax();
+
+    // Runs the enclosed code at CPU_BOOST_MHZ when auto_cpu_frequency is on
+    class CpuBoostScope
+    {
+    public:
+        explicit CpuBoostScope(Hublink &hublink) : hublink(hublink) { hublink.cpuBoost(); }
+        ~CpuBoostScope() { hublink.cpuRelax(); }
+
+    private:
+        Hublink &hublink;
+    };
+    // Charges the enclosed code to a phase, then returns to the previous one
+    class PhaseScope
+    {
+    public:
+        PhaseScope(Hublink &hublink, SyncPhase phase) : hublink(hublink), previous(hublink.switchPhase(phase)) {}
+        ~PhaseScope() { hublink.switchPhase(previous); }
+
+    private:
+        Hublink &hublink;
+        SyncPhase previous;
+    };
+    MemSample memSamples[HUBLINK_MEM_SAMPLES];
+    HublinkTraceRing<HUBLINK_TRACE_EVENTS_KEPT> &trace; // in RTC memory, see rtcTrace
+
+    // Snapshot of the trace ring taken with the listing; transfers read from it, not the live ring
+    static constexpr size_t TRACE_FILE_HEADER = 8;
+    alignas(4) uint8_t traceFile[TRACE_FILE_HEADER + HUBLINK_TRACE_EVENTS_KEPT * sizeof(HublinkTraceEvent)];
+    size_t traceFileLength = 0;
+    uint32_t traceFileEnd = 0; // ring position after the last event in the snapshot
+    void appendTraceListing(String &fileInfo);
+    bool isTraceFile(const char *fileName) const { return offer_trace_file && strcmp(fileName, TRACE_FILE_NAME) == 0; }
+    uint32_t memSampleCount = 0; // total taken; guarded by stateMutex
+
+    // Background sync
+    static constexpr uint32_t SYNC_TASK_STACK_SIZE = 8192;
+    static constexpr UBaseType_t SYNC_TASK_PRIORITY = 1; // below the NimBLE host task
+    std::atomic<bool> syncInProgress{false};
+    std::atomic<bool> lastSyncResult{false};
+    uint32_t asyncConnectFor = 0;
+    SyncCompleteCallback asyncCallback = nullptr;
+    TaskHandle_t syncTask = nullptr;
+    SemaphoreHandle_t storageMutex = nullptr;
+    SemaphoreHandle_t stateMutex = nullptr; // alert and other values the sketch sets while syncing
+    SemaphoreHandle_t metaMutex = nullptr;  // metaDoc and the settings read from it; taken before storageMutex
+    static void syncTaskEntry(void *arg);
+    bool runSync(uint32_t temporaryConnectFor);
 
     // Static callback instances - these must exist for the lifetime of the BLE connection
     static HublinkServerCallbacks serverCallbacks;
     static HublinkFilenameCallbacks filenameCallbacks;
     static HublinkGatewayCallbacks gatewayCallbacks;
+    static HublinkMetaUploadCallbacks metaUploadCallbacks;
 
     // Add to protected members
     TimestampCallback _timestampCallback = nullptr;
-    void handleTimestamp(const String &timestamp);
+    void handleTimestamp(const char *timestamp);
 
-    // Meta.json transfer state
-    bool metaJsonTransferInProgress = false;
-    uint32_t lastMetaJsonId = 0;
+    // Meta.json uploads are per session (Session::meta); patches write through their own temp file
     String tempMetaJsonPath = "/meta.json.tmp";
-    File tempMetaJsonFile;
-    unsigned long metaJsonLastChunkTime = 0;
     const unsigned long META_JSON_TIMEOUT_MS = 5000; // 5 second timeout
-    bool metaJsonUpdated = false;
+    std::atomic<bool> metaJsonUpdated{false}; // set by finalize (BLE task), consumed by doBLE
+    uint32_t temporaryAdvertiseFor = 0; // sync(temporaryConnectFor); advertise_for itself is left as is
+    uint32_t advertiseForSeconds() const { return temporaryAdvertiseFor > 0 ? temporaryAdvertiseFor : advertise_for; }
 
-    // Meta.json handling methods
-    bool beginMetaJsonTransfer();
-    bool processMetaJsonChunk(const String &data);
-    bool finalizeMetaJsonTransfer();
-    void cleanupMetaJsonTransfer();
+    // Validate a complete temp file and rename it over meta.json
+    bool installMetaJson(const char *tempPath);
     bool validateJsonStructure(const String &jsonStr);
 
-    // Add retry tracking
-    uint8_t currentRetryAttempt = 0;
-    unsigned long lastRetryMillis = 0;
-    bool connectionAttempted = false;
-
     // Connection state tracking
     bool didConnect = false; // Tracks if a connection was established during the current sync cycle
 
@@ -366,6 +906,11 @@ protected:
     void cleanupCallbacks();
     /** Null out NimBLE object pointers after deinit or failed setup. */
     void clearNimbleBlePointers();
+    void attachCallbacks();
+    void teardownBLE();
+    String bleInitName = ""; // name the stack was initialized with; a change forces a full init
+    unsigned long lastBLEStartMicros = 0;
+    unsigned long lastBLEStopMicros = 0;
 
     // Default values for BLE configuration
     static constexpr uint32_t DEFAULT_ADVERTISE_EVERY = 300; // 5 minutes
@@ -376,22 +921,169 @@ protected:
     static constexpr bool DEFAULT_TRY_RECONNECT = true;
     static constexpr uint8_t DEFAULT_RECONNECT_ATTEMPTS = 3;
     static constexpr uint32_t DEFAULT_RECONNECT_EVERY = 30; // seconds
-
-    // Helper function to extract nested JSON values
-    String getNestedJsonValue(const JsonDocument &doc, const String &path);
+    static constexpr CommitPolicy DEFAULT_COMMIT_POLICY = CommitPolicy::ARCHIVE;
+    static constexpr ShardMode DEFAULT_SHARD_MODE = ShardMode::NONE;
+    static constexpr uint16_t DEFAULT_SHARD_SIZE = 64;
 
     // Helper function to build node characteristic JSON
     String buildNodeCharacteristicJson();
 
-    // Path processing helpers
-    String sanitizePath(const String &path);
-    String processAppendPath(const JsonDocument &doc, const String &basePath, const String &appendPath);
+    // append_path is compiled once and re-resolved on every meta.json read
+    static constexpr size_t MAX_UPLOAD_PATH = 256;
+    HublinkPathResolver appendPathResolver;
+    char resolvedUploadPath[MAX_UPLOAD_PATH] = {0};
+    bool resolveUploadPath(const JsonDocument &doc, const char *basePath);
+
+    // Characteristic writes, queued by the NimBLE host task and handled in order by doBLE()
+    static constexpr uint8_t COMMAND_FILENAME = 1;
+    static constexpr uint8_t COMMAND_GATEWAY = 2;
+    static constexpr uint8_t COMMAND_META_UPLOAD = 3; // binary meta.json packet, header included
+    static constexpr size_t COMMAND_QUEUE_DEPTH = 8;
+    static constexpr size_t COMMAND_MAX_PAYLOAD = 512; // one ATT write at the negotiated MTU
+    void enqueueCommand(uint8_t type, uint16_t connHandle, const uint8_t *data, size_t length);
+    std::atomic<uint32_t> droppedCommands{0};
+
+    // One session per connected gateway. The NimBLE host task only claims a slot (onConnect),
+    // marks it closing (onDisconnect) and queues writes; doBLE() does everything else.
+    enum SessionState : uint8_t
+    {
+        SESSION_FREE,
+        SESSION_ACTIVE,
+        SESSION_CLOSING
+    };
+    struct Session
+    {
+        std::atomic<uint8_t> state{SESSION_FREE};
+        uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE;
+        uint16_t mtuSize = 20;
+        unsigned long watchdogTimer = 0;
+        HublinkCommandQueue<COMMAND_QUEUE_DEPTH, COMMAND_MAX_PAYLOAD> commands;
+        const uint8_t *source = nullptr; // in-memory file (trace) instead of the card
+        size_t sourceLength = 0;
+        uint32_t traceEnd = 0; // trace ring position the snapshot being sent ends at
+
+        // File transfer in progress, advanced one chunk per doBLE() pass
+        bool transferring = false;
+        String fileName;
+        File file;
+        uint8_t *buffer = nullptr;
+        size_t bufferSize = 0;
+        bool ownsBuffer = false;
+        bool boosted = false; // holds a CPU boost until the transfer ends
+        size_t filled = 0;
+        size_t offset = 0;
+        size_t remaining = 0;
+        size_t totalSent = 0;
+        mbedtls_sha256_context sha;
+        uint8_t fallback[SD_SECTOR_SIZE]; // used if no read-ahead buffer can be had
+
+        // Listing request, sent one indication per doBLE() pass once the staged listing is complete
+        bool listing = false;
+        size_t listingOffset = 0;
+        bool listingSent = false; // this gateway received the whole listing and its EOF
+
+        // Meta.json upload from this gateway (chunked JSON or binary), into its own temp file
+        struct MetaTransfer
+        {
+            bool inProgress = false;
+            bool binary = false;
+            char path[24] = {0};
+            File file;
+            uint32_t lastId = 0; // chunked: last chunk written
+            unsigned long lastChunkTime = 0;
+            uint32_t total = 0; // binary: size announced by START
+            uint32_t received = 0;
+            uint32_t lastAck = 0;
+            uint32_t lastGap = UINT32_MAX; // offset last reported missing; UINT32_MAX = none
+            size_t fill = 0;
+            uint8_t sector[META_UPLOAD_SECTOR_SIZE];
+            std::atomic<bool> dropped{false}; // a full queue lost a packet; re-ack once drained
+        } meta;
+    };
+    Session sessions[HUBLINK_MAX_SESSIONS];
+    bool readAheadInUse = false; // readAheadBuffer belongs to a transfer
+    Session *findSession(uint16_t connHandle);
+    bool isFileInTransfer(const char *fileName);
+    bool isMetaUploadInProgress() const;
+    bool serviceSessions();
+    void startTransfer(Session &session, const char *fileName);
+    void pumpTransfer(Session &session);
+    void endTransfer(Session &session, bool complete);
+    void pumpListing(Session &session);
+    void closeSession(Session &session);
+    void closeAllSessions();
+    void updateMtuSize(Session &session);
+    void handleGatewayCommand(Session &session, const char *json, size_t length);
+    void sendMemStats(Session &session);
+
+    // Indication to one gateway, confirmed (retried) before returning
+    bool sendIndication(Session &session, NimBLECharacteristic *pChar, const uint8_t *data, size_t length);
+
+    // Meta.json upload, chunked through the gateway characteristic or binary through its own
+    bool beginMetaJsonTransfer(Session &session);
+    bool processMetaJsonChunk(Session &session, const String &data);
+    bool finalizeMetaJsonTransfer(Session &session);
+    void cleanupMetaJsonTransfer(Session &session);
+    void handleMetaJsonChunk(Session &session, uint32_t id, const String &data);
+    void handleMetaUploadPacket(Session &session, const uint8_t *data, size_t length);
+    bool bufferMetaUpload(Session &session, const uint8_t *data, size_t length);
+    bool flushMetaUploadSector(Session &session);
+    void notifyMetaUpload(Session &session, MetaUploadStatus status, uint32_t offset);
+
+    // Gateway-confirmed commits; digest of the last fully transferred file avoids a re-read
+    String lastTransferName;
+    size_t lastTransferSize = 0;
+    String lastTransferDigest;
+    uint32_t lastTransferTraceEnd = 0; // for a trace file: ring position its content ended at
+    struct ManifestEntry
+    {
+        String name;
+        size_t size;
+    };
+    std::vector<ManifestEntry> manifest;
+    std::vector<String> liveFiles;              // guarded by stateMutex
+    std::vector<String> writerOpenFiles;        // guarded by stateMutex
+    std::vector<ManifestEntry> liveSnapshots;   // live files and the length listed for them
+    bool manifestLoaded = false;
+    String computeFileDigest(const char *path, size_t *size);
+    void loadManifest();
+    bool isCommittedInManifest(const char *fileName, size_t size);
+    static String digestToHex(const uint8_t *digest);
+
+    // Shard index: live data files under DATA_DIR, loaded once by scanning the (small) shard directories.
+    // Listings come from the index and its cached sizes; only files handed out by getDataFilePath()
+    // (or open in a writer) are stat'ed again, since those may still grow.
+    struct ShardFile
+    {
+        String name;
+        uint16_t shard; // index into shardDirs
+        size_t size;    // as of the last scan or stat
+        bool written;   // handed out by getDataFilePath() since the index was loaded
+    };
+    // Names handed out by getDataFilePath() whose file does not exist yet
+    struct PendingShardFile
+    {
+        String name;
+        String shard;
+    };
+    static constexpr size_t MAX_FILE_PATH = 256; // resolved paths are built in stack buffers of this size
+    std::vector<String> shardDirs;
+    std::vector<ShardFile> shardFiles;
+    std::vector<PendingShardFile> pendingShardFiles;
+    bool shardIndexLoaded = false;
+    void loadShardIndex();
+    void indexPendingShardFiles();
+    int findShardFile(const char *fileName);
+    int findPendingShardFile(const char *fileName);
+    const char *resolveFilePath(const char *fileName, char *path, size_t pathSize);
+    void removeFromShardIndex(const char *fileName);
+    void appendShardListing(String &fileInfo);
+    void appendListingEntry(String &fileInfo, const char *fileName, size_t size);
+    String currentShardName();
 
     // Add file handle tracking
     File rootFile;
-    File transferFile;
     bool rootFileOpen = false;
-    bool transferFileOpen = false;
 
     // Add document as protected member for getMeta access
     DynamicJsonDocument metaDoc;
@@ -410,7 +1102,7 @@ public:
     {
         if (g_hublink && pServer != nullptr)
         {
-            g_hublink->onConnect();
+            g_hublink->onConnect(connInfo.getConnHandle());
         }
     }
 
@@ -418,7 +1110,7 @@ public:
     {
         if (g_hublink && pServer != nullptr)
         {
-            g_hublink->onDisconnect();
+            g_hublink->onDisconnect(connInfo.getConnHandle());
         }
     }
 };
@@ -430,7 +1122,8 @@ public:
     {
         if (g_hublink && pCharacteristic)
         {
-            g_hublink->currentFileName = String(pCharacteristic->getValue().c_str());
+            const NimBLEAttValue &value = pCharacteristic->getValue(); // queued straight from the attribute
+            g_hublink->enqueueCommand(Hublink::COMMAND_FILENAME, connInfo.getConnHandle(), value.data(), value.length());
         }
     }
 };
@@ -442,41 +1135,22 @@ public:
     {
         if (g_hublink && pCharacteristic)
         {
-            // Handle timestamp
-            String timestamp = g_hublink->parseGateway(pCharacteristic, "timestamp");
-            Serial.println("Timestamp: " + timestamp);
-            if (timestamp.length() > 0)
-            {
-                g_hublink->handleTimestamp(timestamp);
-                Serial.println("Timestamp callback complete.");
-            }
-
-            // Handle sendFilenames flag
-            String sendFilenames = g_hublink->parseGateway(pCharacteristic, "sendFilenames");
-            g_hublink->sendFilenames = (sendFilenames == "true");
-            Serial.println("Send filenames callback complete.");
-
-            // Handle watchdogTimeoutMs
-            String watchdogTimeout = g_hublink->parseGateway(pCharacteristic, "watchdogTimeoutMs");
-            if (watchdogTimeout.length() > 0)
-            {
-                g_hublink->watchdogTimeoutMs = watchdogTimeout.toInt();
-                Serial.println("Watchdog timeout callback complete.");
-            }
-
-            // Handle meta.json transfer
-            String metaJsonId = g_hublink->parseGateway(pCharacteristic, "metaJsonId");
-            String metaJsonData = g_hublink->parseGateway(pCharacteristic, "metaJsonData");
-
-            if (metaJsonId.length() > 0 && metaJsonData.length() > 0)
-            {
-                // Block other operations during meta.json transfer
-                g_hublink->sendFilenames = false;
-                g_hublink->currentFileName = "";
-                g_hublink->handleMetaJsonChunk(metaJsonId.toInt(), metaJsonData);
-            }
+            const NimBLEAttValue &value = pCharacteristic->getValue();
+            g_hublink->enqueueCommand(Hublink::COMMAND_GATEWAY, connInfo.getConnHandle(), value.data(), value.length());
+        }
+    }
+};
+
+class HublinkMetaUploadCallbacks : public NimBLECharacteristicCallbacks
+{
+public:
+    void onWrite(NimBLECharacteristic *pCharacteristic, NimBLEConnInfo &connInfo) override
+    {
+        if (g_hublink && pCharacteristic)
+        {
+            const NimBLEAttValue &value = pCharacteristic->getValue();
+            g_hublink->enqueueCommand(Hublink::COMMAND_META_UPLOAD, connInfo.getConnHandle(), value.data(), value.length());
         }
-        Serial.println("Gateway callback complete.");
     }
 };
 
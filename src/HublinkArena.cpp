@@ -0,0 +1,144 @@
+#include "HublinkArena.h"
+
+HublinkArena *HublinkArena::current = nullptr;
+
+bool HublinkArena::begin(size_t capacity)
+{
+    if (buffer != nullptr)
+    {
+        return true;
+    }
+    capacity = align(capacity);
+    if (psramFound())
+    {
+        buffer = (uint8_t *)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    if (buffer == nullptr)
+    {
+        buffer = (uint8_t *)heap_caps_malloc(capacity, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (buffer == nullptr)
+    {
+        return false;
+    }
+    this->capacity = capacity;
+    used = 0;
+    current = this;
+    return true;
+}
+
+void HublinkArena::end()
+{
+    if (current == this)
+    {
+        current = nullptr;
+    }
+    heap_caps_free(buffer);
+    buffer = nullptr;
+    capacity = 0;
+    used = 0;
+    owner = nullptr;
+}
+
+void HublinkArena::open()
+{
+    used = 0;
+    peak = 0;
+    owner = xTaskGetCurrentTaskHandle();
+}
+
+size_t HublinkArena::close()
+{
+    owner = nullptr;
+    used = 0; // blocks still referenced would be a bug: every document is scoped to the sync
+    return peak;
+}
+
+void *HublinkArena::allocate(size_t size)
+{
+    if (buffer == nullptr || owner == nullptr || owner != xTaskGetCurrentTaskHandle())
+    {
+        return nullptr;
+    }
+    size_t needed = HEADER + align(size);
+    if (needed > capacity - used)
+    {
+        overflows++;
+        return nullptr;
+    }
+    uint8_t *block = buffer + used + HEADER;
+    *(size_t *)(block - HEADER) = size;
+    used += needed;
+    peak = std::max(peak, used);
+    highWater = std::max(highWater, used);
+    return block;
+}
+
+void HublinkArena::release(void *block)
+{
+    uint8_t *start = (uint8_t *)block;
+    if (owner != nullptr && start + align(blockSize(block)) == buffer + used)
+    {
+        used = start - HEADER - buffer; // most recent block: rewind
+    }
+}
+
+bool HublinkArena::resize(void *block, size_t size)
+{
+    uint8_t *start = (uint8_t *)block;
+    if (owner == nullptr || start + align(blockSize(block)) != buffer + used ||
+        align(size) > capacity - (start - buffer))
+    {
+        return false;
+    }
+    *(size_t *)(start - HEADER) = size;
+    used = start - buffer + align(size);
+    peak = std::max(peak, used);
+    highWater = std::max(highWater, used);
+    return true;
+}
+
+size_t HublinkArena::blockSize(const void *block) const
+{
+    return *(const size_t *)((const uint8_t *)block - HEADER);
+}
+
+void *HublinkArenaAllocator::allocate(size_t size)
+{
+    HublinkArena *arena = HublinkArena::instance();
+    void *block = arena ? arena->allocate(size) : nullptr;
+    return block ? block : malloc(size);
+}
+
+void HublinkArenaAllocator::deallocate(void *pointer)
+{
+    HublinkArena *arena = HublinkArena::instance();
+    if (arena && arena->owns(pointer))
+    {
+        arena->release(pointer);
+    }
+    else
+    {
+        free(pointer);
+    }
+}
+
+void *HublinkArenaAllocator::reallocate(void *pointer, size_t size)
+{
+    HublinkArena *arena = HublinkArena::instance();
+    if (!arena || !arena->owns(pointer))
+    {
+        return realloc(pointer, size);
+    }
+    if (arena->resize(pointer, size))
+    {
+        return pointer;
+    }
+    void *moved = allocate(size);
+    if (moved)
+    {
+        memcpy(moved, pointer, std::min(size, arena->blockSize(pointer)));
+        arena->release(pointer);
+    }
+    return moved;
+}
@@ -0,0 +1,82 @@
+#ifndef HublinkArena_h
+#define HublinkArena_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Bump allocator for the transient allocations of one sync.
+//
+// The buffer is allocated once (PSRAM preferred) and kept. Between open()
+// and close() the task that opened the arena gets its JSON documents from
+// it: allocate() bumps a pointer, releasing the most recent block rewinds
+// it (scoped documents are released in reverse order), and close() drops
+// whatever is left in one step. Nothing from a sync reaches the general
+// heap, so thousands of syncs cannot fragment it, and the peak use of
+// each sync is one number for sizing RAM.
+//
+// Requests from other tasks (loop() reading meta.json during a background
+// sync) fall back to the heap without being counted. Requests from the
+// owning task that do not fit fall back too, and are counted as overflows,
+// so the count says only whether the arena is too small.
+//
+// Usage:
+//   HublinkJsonDocument doc(1024); // from the arena during a sync, heap otherwise
+class HublinkArena
+{
+public:
+    /** Allocate the buffer (once; capacity is fixed after that). */
+    bool begin(size_t capacity);
+    void end();
+
+    /** Start serving the calling task. */
+    void open();
+
+    /** Stop serving and drop everything still allocated. @return peak bytes used since open() */
+    size_t close();
+
+    void *allocate(size_t size);
+    void release(void *block);
+    /** Grow or shrink the most recent block in place. @return false if it cannot be done in place */
+    bool resize(void *block, size_t size);
+    size_t blockSize(const void *block) const;
+    bool owns(const void *block) const { return block >= buffer && block < buffer + capacity; }
+
+    size_t getCapacity() const { return capacity; }
+    size_t getUsed() const { return used; }
+    size_t getPeak() const { return peak; }           // current/last sync
+    size_t getHighWater() const { return highWater; } // all syncs since begin()
+    uint32_t getOverflowCount() const { return overflows; }
+
+    /** Arena the JSON allocator uses, nullptr if none. */
+    static HublinkArena *instance() { return current; }
+
+private:
+    static constexpr size_t ALIGNMENT = 8;
+    static constexpr size_t HEADER = ALIGNMENT; // block size, kept just before the block
+
+    static HublinkArena *current;
+    uint8_t *buffer = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t peak = 0;
+    size_t highWater = 0;
+    uint32_t overflows = 0;
+    TaskHandle_t owner = nullptr;
+
+    static size_t align(size_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+};
+
+// ArduinoJson allocator backed by the open arena, falling back to the heap
+struct HublinkArenaAllocator
+{
+    void *allocate(size_t size);
+    void deallocate(void *pointer);
+    void *reallocate(void *pointer, size_t size);
+};
+
+typedef BasicJsonDocument<HublinkArenaAllocator> HublinkJsonDocument;
+
+#endif
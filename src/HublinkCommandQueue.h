@@ -0,0 +1,78 @@
+#ifndef HublinkCommandQueue_h
+#define HublinkCommandQueue_h
+
+#include <Arduino.h>
+#include <atomic>
+
+// Bounded lock-free queue of raw characteristic writes.
+//
+// NimBLE delivers filename and gateway writes on its host task; doBLE()
+// consumes them on the sync task. The host task is the only producer and
+// doBLE() the only consumer, so a single-producer/single-consumer ring with
+// acquire/release indices is enough: push() copies the write into a fixed
+// slot, and the consumer handles slots in arrival order. A gateway can
+// pipeline requests (list, fetch, fetch, commit, ...) without waiting for
+// each one, and nothing is overwritten while the transfer loop is busy.
+template <size_t Capacity, size_t MaxPayload>
+class HublinkCommandQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    struct Command
+    {
+        uint8_t type;
+        uint16_t length;
+        char data[MaxPayload + 1]; // NUL-terminated for the JSON and filename parsers
+    };
+
+    /** Producer side. @return false if the queue is full or the write is too long */
+    bool push(uint8_t type, const char *data, size_t length)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (length > MaxPayload || h - tail.load(std::memory_order_acquire) >= Capacity)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Command &slot = slots[h & (Capacity - 1)];
+        slot.type = type;
+        slot.length = (uint16_t)length;
+        memcpy(slot.data, data, length);
+        slot.data[length] = '\0';
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer side. @return oldest command, or nullptr if empty; valid until pop() */
+    Command *front()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &slots[t & (Capacity - 1)];
+    }
+
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /** Consumer side: discard everything queued (e.g. left over from a previous connection). */
+    void clear()
+    {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    uint32_t getDroppedCount() const { return dropped; }
+
+private:
+    Command slots[Capacity];
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+};
+
+#endif
@@ -0,0 +1,337 @@
+#include "HublinkLogger.h"
+
+HublinkLogger::HublinkLogger(Hublink &hublink) : hublink(hublink)
+{
+}
+
+HublinkLogger::~HublinkLogger()
+{
+    end();
+}
+
+bool HublinkLogger::begin(const char *fileName, size_t recordSize, size_t capacity,
+                          HublinkRecordFormatter formatter, uint32_t flushEveryMs)
+{
+    if (running || fileName == nullptr || recordSize == 0)
+    {
+        return false;
+    }
+
+    size_t slots = 2;
+    while (slots < capacity)
+    {
+        slots <<= 1;
+    }
+
+    // PSRAM is preferred so a deep ring does not take internal heap from BLE
+    uint8_t *buffer = nullptr;
+    if (psramFound())
+    {
+        buffer = (uint8_t *)heap_caps_malloc(slots * recordSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    }
+    if (buffer == nullptr)
+    {
+        buffer = (uint8_t *)heap_caps_malloc(slots * recordSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (buffer == nullptr)
+    {
+        Serial.println("Logger: ring allocation failed");
+        return false;
+    }
+
+    baseName = fileName;
+    hublink.lockStorage();
+    bool opened = openLiveFile();
+    hublink.unlockStorage();
+    if (!opened)
+    {
+        Serial.printf("Logger: failed to open %s\n", path.c_str());
+        heap_caps_free(buffer);
+        return false;
+    }
+
+    ring = buffer;
+    this->recordSize = recordSize;
+    this->capacity = slots;
+    this->formatter = formatter;
+    this->flushEveryMs = flushEveryMs;
+    head = 0;
+    tail = 0;
+    sectorFill = 0;
+    unflushed = false;
+    stopRequested = false;
+    running = true;
+
+    if (xTaskCreatePinnedToCore(writerEntry, "hublink_log", WRITER_STACK_SIZE, this,
+                                WRITER_PRIORITY, &writerTask, tskNO_AFFINITY) != pdPASS)
+    {
+        Serial.println("Logger: could not start writer task");
+        running = false;
+        hublink.lockStorage();
+        closeLiveFile();
+        hublink.unlockStorage();
+        heap_caps_free(ring);
+        ring = nullptr;
+        return false;
+    }
+    Serial.printf("Logger: %s, %u x %u-byte records\n", path.c_str(), (unsigned)slots, (unsigned)recordSize);
+    return true;
+}
+
+void HublinkLogger::setRotation(size_t maxBytes, uint32_t maxSeconds)
+{
+    rotateBytes = maxBytes;
+    rotateMs = maxSeconds * 1000UL;
+}
+
+// Next file: "name.csv" as given, or "name_000042.csv" when rotating. Call with the storage lock held.
+bool HublinkLogger::openLiveFile()
+{
+    bool rotating = rotateBytes > 0 || rotateMs > 0;
+    if (rotating)
+    {
+        int dot = baseName.lastIndexOf('.');
+        String stem = dot > 0 ? baseName.substring(0, dot) : baseName;
+        String extension = dot > 0 ? baseName.substring(dot) : "";
+
+        // The sequence is kept on the card so names are never reused, even after a commit removed the file
+        fs::FS &fs = hublink.getStorage().fs();
+        String sequencePath = "/.hublink_seq_" + stem;
+        File sequenceFile = fs.open(sequencePath, FILE_READ);
+        uint32_t sequence = sequenceFile ? sequenceFile.readStringUntil('\n').toInt() : 0;
+        sequenceFile.close();
+        char suffix[16];
+        do
+        {
+            snprintf(suffix, sizeof(suffix), "_%06lu", (unsigned long)++sequence);
+        } while (hublink.dataFileExists(stem + suffix + extension));
+        sequenceFile = fs.open(sequencePath, FILE_WRITE);
+        if (sequenceFile)
+        {
+            sequenceFile.println(sequence);
+            sequenceFile.close();
+        }
+        currentName = stem + suffix + extension;
+    }
+    else
+    {
+        currentName = baseName;
+    }
+
+    path = hublink.getDataFilePath(currentName);
+    file = hublink.getStorage().fs().open(path, FILE_APPEND);
+    openedAtRemount = hublink.getSDRemountCount();
+    openedMs = millis();
+    if (!file)
+    {
+        return false;
+    }
+    fileSize = file.size();
+
+    // A file that never rotates keeps the accumulator behaviour and stays listable, but either
+    // way Hublink must not archive or delete it while it is open here
+    hublink.setFileWriterOpen(currentName, true);
+    if (rotating)
+    {
+        hublink.setFileLive(currentName, true);
+    }
+    return true;
+}
+
+// Call with the storage lock held
+void HublinkLogger::closeLiveFile()
+{
+    file.close();
+    hublink.setFileLive(currentName, false);
+    hublink.setFileWriterOpen(currentName, false);
+}
+
+// Close the live file so it can be listed, transferred and committed, and start the next one
+void HublinkLogger::seal()
+{
+    writeOutRetrying(true); // the buffered tail belongs to this file
+    hublink.lockStorage();
+    closeLiveFile();
+    sealed.fetch_add(1, std::memory_order_relaxed);
+    Serial.printf("Logger: sealed %s (%u bytes)\n", currentName.c_str(), (unsigned)fileSize);
+    if (!openLiveFile())
+    {
+        Serial.printf("Logger: failed to open %s\n", path.c_str()); // writeOut retries the open
+    }
+    hublink.unlockStorage();
+}
+
+void HublinkLogger::end()
+{
+    if (!running)
+    {
+        return;
+    }
+    stopRequested = true;
+    while (running)
+    {
+        delay(1); // writer drains, flushes and closes the file
+    }
+    writerTask = nullptr;
+    heap_caps_free(ring);
+    ring = nullptr;
+}
+
+bool HublinkLogger::push(const void *record)
+{
+    if (!running || stopRequested)
+    {
+        return false;
+    }
+
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= capacity)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    memcpy(ring + (h & (capacity - 1)) * recordSize, record, recordSize);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+}
+
+void HublinkLogger::writerEntry(void *arg)
+{
+    HublinkLogger *self = static_cast<HublinkLogger *>(arg);
+    unsigned long lastFlush = millis();
+
+    while (!self->stopRequested)
+    {
+        self->drain();
+        if (self->rotateMs > 0 && self->fileSize + self->sectorFill > 0 &&
+            millis() - self->openedMs >= self->rotateMs)
+        {
+            self->seal();
+            lastFlush = millis();
+        }
+        if (millis() - lastFlush >= self->flushEveryMs)
+        {
+            self->writeOut(true);
+            lastFlush = millis();
+        }
+        vTaskDelay(pdMS_TO_TICKS(DRAIN_INTERVAL_MS));
+    }
+
+    self->drain();
+    self->writeOutRetrying(true);
+    self->hublink.lockStorage();
+    self->closeLiveFile();
+    self->hublink.unlockStorage();
+    self->running = false;
+    vTaskDelete(nullptr);
+}
+
+void HublinkLogger::drain()
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    while (t != h)
+    {
+        const uint8_t *record = ring + (t & (capacity - 1)) * recordSize;
+        if (formatter)
+        {
+            char line[MAX_LINE];
+            size_t length = formatter(record, line, sizeof(line));
+            append((const uint8_t *)line, std::min(length, sizeof(line)));
+        }
+        else
+        {
+            append(record, recordSize);
+        }
+        tail.store(++t, std::memory_order_release); // slot is free once copied out
+        written.fetch_add(1, std::memory_order_relaxed);
+        if (rotateBytes > 0 && fileSize + sectorFill >= rotateBytes)
+        {
+            seal(); // between records, so no record is split across files
+        }
+    }
+}
+
+// Fill the sector buffer up to the next 512-byte file offset, then write it in one piece
+void HublinkLogger::append(const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        size_t room = SECTOR_SIZE - (fileSize + sectorFill) % SECTOR_SIZE;
+        size_t take = std::min(room, length);
+        memcpy(sector + sectorFill, data, take);
+        sectorFill += take;
+        data += take;
+        length -= take;
+        if (take == room)
+        {
+            writeOutRetrying(false); // nothing more fits until this sector is written
+        }
+    }
+}
+
+bool HublinkLogger::writeOut(bool flush)
+{
+    if (sectorFill == 0 && !(flush && unflushed))
+    {
+        return true;
+    }
+
+    hublink.lockStorage();
+    // Handles do not survive a re-mount by Hublink (card swap, SD error recovery)
+    if (!file || openedAtRemount != hublink.getSDRemountCount())
+    {
+        file.close();
+        file = hublink.getStorage().fs().open(path, FILE_APPEND);
+        openedAtRemount = hublink.getSDRemountCount();
+        if (file)
+        {
+            fileSize = file.size();
+        }
+    }
+
+    bool ok = (bool)file;
+    size_t writtenBytes = 0;
+    if (ok && sectorFill > 0)
+    {
+        writtenBytes = file.write(sector, sectorFill);
+        ok = writtenBytes == sectorFill;
+        unflushed = true;
+    }
+    if (ok && flush)
+    {
+        file.flush();
+        unflushed = false;
+    }
+    if (!ok)
+    {
+        file.close(); // reopened on the next write
+    }
+    hublink.unlockStorage();
+
+    // Whatever was not written stays buffered for the next attempt
+    fileSize += writtenBytes;
+    sectorFill -= writtenBytes;
+    memmove(sector, sector + writtenBytes, sectorFill);
+    if (!ok)
+    {
+        writeErrors.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ok;
+}
+
+// Keep the buffered data through SD errors (the ring absorbs new records meanwhile); it is
+// dropped only if the logger is stopping and the card still fails after WRITE_RETRIES attempts
+void HublinkLogger::writeOutRetrying(bool flush)
+{
+    for (uint8_t attempt = 1; !writeOut(flush); attempt++)
+    {
+        if (stopRequested && attempt >= WRITE_RETRIES)
+        {
+            Serial.printf("Logger: dropped %u buffered bytes of %s\n", (unsigned)sectorFill, currentName.c_str());
+            sectorFill = 0;
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(WRITE_RETRY_MS));
+    }
+}
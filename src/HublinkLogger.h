@@ -0,0 +1,127 @@
+#ifndef HublinkLogger_h
+#define HublinkLogger_h
+
+#include "Hublink.h"
+
+// Sample logging front end for Hublink sketches.
+//
+// The sketch pushes fixed-size records into a lock-free single-producer,
+// single-consumer ring; push() never blocks and never touches the SD card.
+// A low-priority writer task drains the ring into a 512-byte sector buffer
+// and writes whole sectors at sector-aligned file offsets, flushing the
+// partial tail every flushEveryMs. Each write holds Hublink's storage lock,
+// so logging and doBLE() transfers share the card without a re-mount ever
+// landing in the middle of a write.
+//
+// With setRotation() the writer seals a file at a size or age limit and
+// continues in the next one; Hublink only offers sealed files, so every
+// transfer is bounded and never races the writer. Without rotation the one
+// file is listed while it grows, but Hublink refuses to commit it while the
+// logger has it open. A failed SD write keeps the buffered sector and is
+// retried; records wait in the ring meanwhile.
+//
+// Records are written as raw bytes, or through a formatter that turns each
+// record into a line of text (CSV) on the writer task.
+//
+// Usage:
+//   struct Sample { uint32_t ms; int16_t value; };
+//   HublinkLogger logger(hublink);
+//   logger.begin("samples.csv", sizeof(Sample), 512, formatSample);
+//   Sample s = {millis(), analogRead(A1)};
+//   logger.push(&s);
+typedef size_t (*HublinkRecordFormatter)(const void *record, char *out, size_t outSize);
+
+class HublinkLogger
+{
+public:
+    static constexpr size_t SECTOR_SIZE = 512;
+    static constexpr size_t MAX_LINE = 128; // formatter output limit per record
+
+    explicit HublinkLogger(Hublink &hublink);
+    ~HublinkLogger();
+
+    /**
+     * Open (append) fileName through Hublink::getDataFilePath() and start the writer task.
+     *
+     * @param recordSize bytes per record
+     * @param capacity ring size in records, rounded up to a power of two; size it for the
+     *                 longest expected SD stall (e.g. 1 s at the sample rate)
+     * @param formatter optional record-to-text conversion, run on the writer task
+     * @param flushEveryMs how often buffered data is written out and flushed
+     */
+    bool begin(const char *fileName, size_t recordSize, size_t capacity = 256,
+               HublinkRecordFormatter formatter = nullptr, uint32_t flushEveryMs = 1000);
+
+    /**
+     * Seal the current file once it reaches maxBytes or has been open maxSeconds (0 = no limit),
+     * then continue in a new one. Call before begin(). With rotation, files are named
+     * "name_000001.csv", "name_000002.csv", ... and the file being written is marked live, so
+     * Hublink lists, transfers and commits only sealed files (see Hublink::offer_live_files).
+     */
+    void setRotation(size_t maxBytes, uint32_t maxSeconds = 0);
+
+    /** Flush everything pushed so far, stop the writer task and close the file. */
+    void end();
+
+    /**
+     * Copy one record into the ring. Call from a single task only.
+     * @return false if the ring is full (the record is counted as dropped)
+     */
+    bool push(const void *record);
+
+    uint32_t getDroppedCount() const { return dropped; }
+    uint32_t getWrittenCount() const { return written; }
+    uint32_t getWriteErrorCount() const { return writeErrors; }
+    uint32_t getSealedCount() const { return sealed; }
+    const String &getCurrentFileName() const { return currentName; }
+    size_t getPending() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    bool isRunning() const { return running; }
+
+private:
+    static constexpr uint32_t WRITER_STACK_SIZE = 4096;
+    static constexpr UBaseType_t WRITER_PRIORITY = 1;
+    static constexpr uint32_t DRAIN_INTERVAL_MS = 10;
+    static constexpr uint32_t WRITE_RETRY_MS = 100;
+    static constexpr uint8_t WRITE_RETRIES = 5; // when stopping; otherwise retried until the card recovers
+
+    Hublink &hublink;
+    String baseName;
+    String currentName;
+    String path;
+    size_t rotateBytes = 0;
+    uint32_t rotateMs = 0;
+    unsigned long openedMs = 0;
+    size_t recordSize = 0;
+    size_t capacity = 0; // power of two
+    uint8_t *ring = nullptr;
+    std::atomic<size_t> head{0}; // written by push()
+    std::atomic<size_t> tail{0}; // written by the writer task
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> written{0};
+    std::atomic<uint32_t> writeErrors{0};
+    std::atomic<uint32_t> sealed{0};
+
+    HublinkRecordFormatter formatter = nullptr;
+    uint32_t flushEveryMs = 1000;
+    uint8_t sector[SECTOR_SIZE];
+    size_t sectorFill = 0;
+    File file;
+    uint32_t openedAtRemount = 0;
+    size_t fileSize = 0; // tracks alignment of the next write
+    bool unflushed = false;
+
+    TaskHandle_t writerTask = nullptr;
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopRequested{false};
+
+    static void writerEntry(void *arg);
+    void drain();
+    void append(const uint8_t *data, size_t length);
+    bool writeOut(bool flush);
+    void writeOutRetrying(bool flush);
+    bool openLiveFile();
+    void closeLiveFile();
+    void seal();
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "HublinkPathResolver.h"
+
+namespace
+{
+    // Writes characters through the sanitizer as they are produced
+    struct PathWriter
+    {
+        char *out;
+        size_t capacity;
+        size_t length = 0;
+        bool overflow = false;
+
+        PathWriter(char *buffer, size_t size) : out(buffer), capacity(size) {}
+
+        static bool allowed(char c)
+        {
+            return isalnum((unsigned char)c) || c == '-' || c == '_' || c == '+' || c == '.' || c == '/';
+        }
+
+        void put(char c)
+        {
+            if (!allowed(c))
+            {
+                return;
+            }
+            if (c == '/' && length > 0 && out[length - 1] == '/')
+            {
+                return; // collapse repeated slashes
+            }
+            if (length + 1 >= capacity)
+            {
+                overflow = true;
+                return;
+            }
+            out[length++] = c;
+        }
+
+        void put(const char *s, size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                put(s[i]);
+            }
+        }
+
+        void separator()
+        {
+            if (length == 0 || out[length - 1] != '/')
+            {
+                put('/');
+            }
+        }
+
+        size_t finish()
+        {
+            while (length > 0 && out[length - 1] == '/')
+            {
+                length--;
+            }
+            out[length] = '\0';
+            return length;
+        }
+    };
+}
+
+void HublinkPathResolver::clear()
+{
+    source[0] = '\0';
+    text[0] = '\0';
+    count = 0;
+    compiled = false;
+}
+
+bool HublinkPathResolver::compile(const char *appendPath)
+{
+    if (appendPath == nullptr)
+    {
+        appendPath = "";
+    }
+    if (compiled && strcmp(appendPath, source) == 0)
+    {
+        return true;
+    }
+
+    clear();
+    size_t length = strlen(appendPath);
+    if (length > MAX_SOURCE)
+    {
+        return false;
+    }
+    memcpy(source, appendPath, length + 1);
+    memcpy(text, appendPath, length + 1);
+
+    // Split "parent:child/parent:child" in place; the child keeps any further ':'
+    size_t start = 0;
+    while (start < length)
+    {
+        size_t end = start;
+        while (end < length && text[end] != '/')
+        {
+            end++;
+        }
+        text[end] = '\0';
+
+        char *colon = strchr(text + start, ':');
+        if (colon != nullptr)
+        {
+            if (count == MAX_TOKENS)
+            {
+                clear();
+                return false;
+            }
+            *colon = '\0';
+            tokens[count].parent = (uint8_t)start;
+            tokens[count].child = (uint8_t)(colon - text + 1);
+            count++;
+        }
+        start = end + 1;
+    }
+
+    compiled = true;
+    return true;
+}
+
+bool HublinkPathResolver::resolve(JsonVariantConst doc, const char *basePath, char *out, size_t outSize) const
+{
+    if (out == nullptr || outSize == 0)
+    {
+        return false;
+    }
+
+    PathWriter writer(out, outSize);
+    if (basePath != nullptr)
+    {
+        writer.put(basePath, strlen(basePath));
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        JsonVariantConst value = doc[text + tokens[i].parent][text + tokens[i].child];
+
+        char number[24];
+        const char *str = nullptr;
+        if (value.is<const char *>())
+        {
+            str = value.as<const char *>();
+        }
+        else if (value.is<bool>())
+        {
+            str = value.as<bool>() ? "true" : "false";
+        }
+        else if (value.is<long>())
+        {
+            snprintf(number, sizeof(number), "%ld", value.as<long>());
+            str = number;
+        }
+        else if (value.is<double>())
+        {
+            snprintf(number, sizeof(number), "%g", value.as<double>());
+            str = number;
+        }
+        if (str == nullptr)
+        {
+            continue; // missing keys and non-scalar values are skipped
+        }
+
+        // Trim surrounding whitespace without copying
+        const char *end = str + strlen(str);
+        while (str < end && isspace((unsigned char)*str))
+        {
+            str++;
+        }
+        while (end > str && isspace((unsigned char)end[-1]))
+        {
+            end--;
+        }
+        if (str == end)
+        {
+            continue;
+        }
+
+        writer.separator();
+        writer.put(str, end - str);
+    }
+
+    writer.finish();
+    if (writer.overflow)
+    {
+        out[0] = '\0';
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#ifndef HublinkPathResolver_h
+#define HublinkPathResolver_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Compiled form of hublink.append_path ("subject:id/experimenter:name").
+//
+// compile() copies the path once into a fixed buffer and splits it into
+// parent/child tokens in place. resolve() then walks the tokens, looks each
+// value up in meta.json and writes the sanitized upload path into a caller
+// buffer in a single pass, without heap allocation.
+//
+// Sanitizing matches the S3-safe rules in README.md: only [A-Za-z0-9-_+./]
+// are kept, repeated slashes collapse and trailing slashes are removed.
+class HublinkPathResolver
+{
+public:
+    static constexpr size_t MAX_SOURCE = 128; // matches the upload_path length limit
+    static constexpr size_t MAX_TOKENS = 16;
+
+    /**
+     * Compile an append_path expression. Segments without a ':' are ignored,
+     * as before. Recompiling the same expression is a no-op.
+     *
+     * @return false if the expression is too long or has too many segments
+     */
+    bool compile(const char *appendPath);
+
+    /**
+     * Resolve basePath plus the compiled segments against doc into out.
+     *
+     * @return false if out is too small (out is then empty)
+     */
+    bool resolve(JsonVariantConst doc, const char *basePath, char *out, size_t outSize) const;
+
+    bool matches(const char *appendPath) const { return compiled && strcmp(appendPath, source) == 0; }
+    bool isCompiled() const { return compiled; }
+    uint8_t tokenCount() const { return count; }
+    void clear();
+
+private:
+    struct Token
+    {
+        uint8_t parent; // offsets into text, NUL-terminated
+        uint8_t child;
+    };
+
+    char source[MAX_SOURCE + 1] = {0}; // original text, used to detect changes
+    char text[MAX_SOURCE + 1] = {0};   // split copy the tokens point into
+    Token tokens[MAX_TOKENS];
+    uint8_t count = 0;
+    bool compiled = false;
+};
+
+#endif
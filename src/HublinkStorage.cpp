@@ -0,0 +1,126 @@
+#include "HublinkStorage.h"
+
+#include <SD.h>
+#include <LittleFS.h>
+#include <vfs_api.h>
+#include <sys/stat.h>
+#if SOC_SDMMC_HOST_SUPPORTED
+#include <SD_MMC.h>
+#endif
+
+// SD over SPI
+
+HublinkSDStorage::HublinkSDStorage(uint8_t chipSelect, uint32_t frequency, SPIClass &spi)
+    : cs(chipSelect), frequency(frequency), spi(spi)
+{
+}
+
+bool HublinkSDStorage::begin()
+{
+    return begin(frequency);
+}
+
+bool HublinkSDStorage::begin(uint32_t frequency)
+{
+    this->frequency = frequency;
+    return SD.begin(cs, spi, frequency) && SD.cardType() != CARD_NONE;
+}
+
+void HublinkSDStorage::end()
+{
+    SD.end();
+}
+
+bool HublinkSDStorage::isMounted()
+{
+    return SD.cardType() != CARD_NONE;
+}
+
+fs::FS &HublinkSDStorage::fs()
+{
+    return SD;
+}
+
+// SD over SDMMC
+
+#if SOC_SDMMC_HOST_SUPPORTED
+HublinkSDMMCStorage::HublinkSDMMCStorage(bool mode1bit, int frequencyKHz)
+    : mode1bit(mode1bit), frequencyKHz(frequencyKHz)
+{
+}
+
+bool HublinkSDMMCStorage::begin()
+{
+    return SD_MMC.begin("/sdcard", mode1bit, false, frequencyKHz) && SD_MMC.cardType() != CARD_NONE;
+}
+
+void HublinkSDMMCStorage::end()
+{
+    SD_MMC.end();
+}
+
+bool HublinkSDMMCStorage::isMounted()
+{
+    return SD_MMC.cardType() != CARD_NONE;
+}
+
+fs::FS &HublinkSDMMCStorage::fs()
+{
+    return SD_MMC;
+}
+#endif
+
+// LittleFS on internal flash
+
+HublinkLittleFSStorage::HublinkLittleFSStorage(bool formatOnFail, const char *partitionLabel)
+    : formatOnFail(formatOnFail), partitionLabel(partitionLabel)
+{
+}
+
+bool HublinkLittleFSStorage::begin()
+{
+    mounted = LittleFS.begin(formatOnFail, "/littlefs", 10, partitionLabel);
+    return mounted;
+}
+
+void HublinkLittleFSStorage::end()
+{
+    LittleFS.end();
+    mounted = false;
+}
+
+bool HublinkLittleFSStorage::isMounted()
+{
+    return mounted;
+}
+
+fs::FS &HublinkLittleFSStorage::fs()
+{
+    return LittleFS;
+}
+
+// POSIX directory
+
+static FSImplPtr makePosixImpl(const char *root)
+{
+    FSImplPtr impl(new VFSImpl());
+    impl->mountpoint(root);
+    return impl;
+}
+
+HublinkPosixStorage::HublinkPosixStorage(const char *rootDirectory)
+    : root(rootDirectory ? rootDirectory : ""),
+      posixFs(makePosixImpl(root.c_str()))
+{
+}
+
+bool HublinkPosixStorage::begin()
+{
+    return isMounted();
+}
+
+bool HublinkPosixStorage::isMounted()
+{
+    struct stat st;
+    return stat(root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
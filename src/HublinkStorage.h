@@ -0,0 +1,121 @@
+#ifndef HublinkStorage_h
+#define HublinkStorage_h
+
+#include <Arduino.h>
+#include <FS.h>
+#include <SPI.h>
+#include <soc/soc_caps.h>
+#include <string>
+
+// Storage backends for Hublink.
+//
+// Hublink does all file access (listing, transfers, meta.json) through
+// fs::FS, so any Arduino-ESP32 filesystem can back it. A backend only has
+// to mount/unmount and report whether the medium is present.
+//
+// Backends:
+// - HublinkSDStorage:       SD card over SPI (default, built from the Hublink constructor)
+// - HublinkSDMMCStorage:    SD card over the SDMMC host, 1- or 4-bit bus
+// - HublinkLittleFSStorage: LittleFS on internal flash
+// - HublinkPosixStorage:    any directory on an ESP-IDF VFS mount point
+//
+// Usage:
+//   HublinkSDMMCStorage sdmmc;
+//   hublink.setStorage(sdmmc); // before begin()
+class HublinkStorage
+{
+public:
+    virtual ~HublinkStorage() {}
+
+    /** Mount the medium if needed. @return true when files can be accessed */
+    virtual bool begin() = 0;
+    virtual void end() = 0;
+
+    /** Cheap presence check, no I/O beyond what the driver caches. */
+    virtual bool isMounted() = 0;
+
+    virtual fs::FS &fs() = 0;
+    virtual const char *name() const = 0;
+};
+
+class HublinkSDStorage : public HublinkStorage
+{
+public:
+    HublinkSDStorage(uint8_t chipSelect, uint32_t frequency, SPIClass &spi = SPI);
+
+    bool begin() override;
+    void end() override;
+    bool isMounted() override;
+    fs::FS &fs() override;
+    const char *name() const override { return "sd-spi"; }
+
+    /** Mount at a specific SPI clock (used by clock negotiation). */
+    bool begin(uint32_t frequency);
+    uint32_t getFrequency() const { return frequency; }
+
+private:
+    uint8_t cs;
+    uint32_t frequency;
+    SPIClass &spi;
+};
+
+#if SOC_SDMMC_HOST_SUPPORTED
+class HublinkSDMMCStorage : public HublinkStorage
+{
+public:
+    /**
+     * @param mode1bit use a 1-bit bus (fewer pins); 4-bit gives several times the bandwidth
+     * @param frequencyKHz SDMMC clock, 20000 (default speed) or 40000 (high speed)
+     */
+    HublinkSDMMCStorage(bool mode1bit = false, int frequencyKHz = 20000);
+
+    bool begin() override;
+    void end() override;
+    bool isMounted() override;
+    fs::FS &fs() override;
+    const char *name() const override { return mode1bit ? "sdmmc-1bit" : "sdmmc-4bit"; }
+
+private:
+    bool mode1bit;
+    int frequencyKHz;
+};
+#endif
+
+class HublinkLittleFSStorage : public HublinkStorage
+{
+public:
+    HublinkLittleFSStorage(bool formatOnFail = false, const char *partitionLabel = "spiffs");
+
+    bool begin() override;
+    void end() override;
+    bool isMounted() override;
+    fs::FS &fs() override;
+    const char *name() const override { return "littlefs"; }
+
+private:
+    bool formatOnFail;
+    const char *partitionLabel;
+    bool mounted = false;
+};
+
+// Plain POSIX directory through the Arduino VFS layer (fopen/opendir), on any VFS
+// mount point the app registered itself (a RAM disk, a FAT partition, a custom driver).
+// This is still device code: VFSImpl, like the rest of Hublink (NimBLE, FreeRTOS),
+// needs Arduino-ESP32, so there is no host build.
+class HublinkPosixStorage : public HublinkStorage
+{
+public:
+    explicit HublinkPosixStorage(const char *rootDirectory);
+
+    bool begin() override;
+    void end() override {}
+    bool isMounted() override;
+    fs::FS &fs() override { return posixFs; }
+    const char *name() const override { return "posix"; }
+
+private:
+    std::string root; // must outlive posixFs; VFSImpl keeps a pointer to it
+    fs::FS posixFs;
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef HublinkTrace_h
+#define HublinkTrace_h
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+// Compile-time trace levels. Set HUBLINK_TRACE_LEVEL as a build flag
+// (e.g. -DHUBLINK_TRACE_LEVEL=0 in platformio.ini build_flags) so the
+// library itself is compiled with it:
+//   0  HUBLINK_TRACE_OFF      debug() events and verbose logging compile away
+//   1  HUBLINK_TRACE_EVENTS   debug() events go to the trace ring (default)
+//   2  HUBLINK_TRACE_VERBOSE  plus per-chunk / per-command Serial logging
+#define HUBLINK_TRACE_OFF 0
+#define HUBLINK_TRACE_EVENTS 1
+#define HUBLINK_TRACE_VERBOSE 2
+
+#ifndef HUBLINK_TRACE_LEVEL
+#define HUBLINK_TRACE_LEVEL HUBLINK_TRACE_EVENTS
+#endif
+
+#if HUBLINK_TRACE_LEVEL >= HUBLINK_TRACE_VERBOSE
+#define HUBLINK_LOGV(...) Serial.printf(__VA_ARGS__)
+#else
+#define HUBLINK_LOGV(...) \
+    do                    \
+    {                     \
+    } while (0)
+#endif
+
+// One event: 8 bytes, the record format of the trace file (little-endian)
+struct HublinkTraceEvent
+{
+    uint32_t us;  // micros() at the event (since that boot)
+    uint16_t arg; // event-specific value (byte count, error code, ...), saturated at 0xFFFF
+    uint8_t code; // DebugByte
+    uint8_t boot; // boot counter (low 8 bits), to tell sessions apart
+};
+
+// Fixed ring of trace events, placed in RTC memory by Hublink (RTC_NOINIT_ATTR)
+// so it survives deep sleep and resets. It has no constructor: restore()
+// checks the magic once per boot and clears the ring only if the memory
+// holds garbage (power-on).
+//
+// push() is a few stores under a spinlock, safe from any task (the NimBLE
+// host task and the sync task both trace). When full, the oldest events
+// are overwritten: the ring always holds the latest Capacity events.
+// pop() hands events to a single drain (the Serial1 debug output) in
+// order, skipping any that were overwritten before it got to them.
+template <size_t Capacity>
+class HublinkTraceRing
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    static constexpr uint32_t MAGIC = 0x484C5452; // "HLTR"
+
+    /** Call once per boot, before any push(). */
+    void restore()
+    {
+        if (magic != MAGIC)
+        {
+            total = 0;
+            drained = 0;
+            lost = 0;
+            committed = 0;
+            boot = 0;
+            magic = MAGIC;
+        }
+        boot++;
+    }
+
+    void push(uint8_t code, uint16_t arg = 0)
+    {
+        uint32_t now = micros();
+        portENTER_CRITICAL(&lock);
+        HublinkTraceEvent &slot = events[total & (Capacity - 1)];
+        slot.us = now;
+        slot.arg = arg;
+        slot.code = code;
+        slot.boot = boot;
+        total++;
+        portEXIT_CRITICAL(&lock);
+    }
+
+    /** Next event not yet drained. @return false if there is none */
+    bool pop(HublinkTraceEvent &event)
+    {
+        portENTER_CRITICAL(&lock);
+        if (total - drained > Capacity)
+        {
+            lost += total - drained - Capacity;
+            drained = total - Capacity;
+        }
+        bool available = drained != total;
+        if (available)
+        {
+            event = events[drained & (Capacity - 1)];
+            drained++;
+        }
+        portEXIT_CRITICAL(&lock);
+        return available;
+    }
+
+    /** Copy the latest events (oldest first) without draining them. @return number copied */
+    size_t copy(HublinkTraceEvent *out, size_t maxEvents)
+    {
+        return copySince(0, out, maxEvents, nullptr);
+    }
+
+    /**
+     * Copy events recorded after position `since` (oldest first), at most the ring's contents.
+     * @param end set to the position after the last event copied
+     */
+    size_t copySince(uint32_t since, HublinkTraceEvent *out, size_t maxEvents, uint32_t *end)
+    {
+        portENTER_CRITICAL(&lock);
+        size_t count = std::min<size_t>(std::min<size_t>(total - since, Capacity), maxEvents);
+        for (size_t i = 0; i < count; i++)
+        {
+            out[i] = events[(total - count + i) & (Capacity - 1)];
+        }
+        if (end)
+        {
+            *end = total;
+        }
+        portEXIT_CRITICAL(&lock);
+        return count;
+    }
+
+    uint32_t getTotal() const { return total; }
+    uint32_t getLost() const { return lost; } // overwritten before they were drained
+    uint32_t getCommitted() const { return committed; }
+    void setCommitted(uint32_t position) { committed = position; } // gateway stored events up to here
+    uint8_t getBoot() const { return boot; }
+
+private:
+    // No initializers: the object lives in RTC_NOINIT memory, see restore()
+    uint32_t magic;
+    uint32_t total;
+    uint32_t drained;
+    uint32_t lost;
+    uint32_t committed;
+    uint8_t boot;
+    HublinkTraceEvent events[Capacity];
+    static portMUX_TYPE lock;
+};
+
+template <size_t Capacity>
+portMUX_TYPE HublinkTraceRing<Capacity>::lock = portMUX_INITIALIZER_UNLOCKED;
+
+#endif